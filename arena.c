@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rxpriv.h"
+
+/*
+Everything the parser makes for a regex, its states, transitions, lists,
+char classes and the Rx of every group, lives until the regex is freed
+and not a moment less, so it is all bump allocated from one arena per
+regex and freed with it in one go. Each block is twice the size of the
+one before, up to ARENA_BLOCK_MAX, so compiling takes a handful of calls
+to malloc however big the regex is. A request that would take a good
+part of a block gets a block of its own.
+*/
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_MIN 1024
+#define ARENA_BLOCK_MAX (1 << 20)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+};
+
+#define ARENA_HEADER \
+    ((sizeof (ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+Arena *
+arena_new (void) {
+    return calloc(1, sizeof (Arena));
+}
+
+void
+arena_free (Arena *arena) {
+    ArenaBlock *block, *next;
+    if (!arena)
+        return;
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+static void *
+arena_block (Arena *arena, size_t size) {
+    ArenaBlock *block = calloc(1, ARENA_HEADER + size);
+    arena->total += ARENA_HEADER + size;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return (char *) block + ARENA_HEADER;
+}
+
+/* Returns size bytes of zeroed memory that last as long as the arena.  */
+void *
+arena_alloc (Arena *arena, size_t size) {
+    char *mem;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (size > (size_t) (arena->end - arena->pos)) {
+        if (size > ARENA_BLOCK_MAX / 4)
+            return arena_block(arena, size);
+        do
+            arena->size = arena->size ? 2 * arena->size : ARENA_BLOCK_MIN;
+        while (arena->size < size);
+        if (arena->size > ARENA_BLOCK_MAX)
+            arena->size = ARENA_BLOCK_MAX;
+        arena->pos = arena_block(arena, arena->size);
+        arena->end = arena->pos + arena->size;
+    }
+    mem = arena->pos;
+    arena->pos += size;
+    return mem;
+}
@@ -6,43 +6,74 @@ isword (int c) {
     return isalnum(c) || c == '_' || c == '-';
 }
 
+/* The string runs from str to end, which is just past its last char, so
+that it can hold NULs.  */
 int
-bos (const char *str, const char *pos) {
+bos (const char *str, const char *end, const char *pos) {
     return pos == str;
 }
 
 int
-bol (const char *str, const char *pos) {
-    return bos(str, pos) || pos[-1] == '\n';
+bol (const char *str, const char *end, const char *pos) {
+    return bos(str, end, pos) || pos[-1] == '\n';
 }
 
 int
-eos (const char *str, const char *pos) {
-    return !*pos;
+eos (const char *str, const char *end, const char *pos) {
+    return pos == end;
 }
 
 int
-eol (const char *str, const char *pos) {
-    return eos(str, pos) || *pos == '\n';
+eol (const char *str, const char *end, const char *pos) {
+    return eos(str, end, pos) || *pos == '\n';
 }
 
 int
-lwb (const char *str, const char *pos) {
-    return (bos(str, pos) || !isword(pos[-1])) && isword(*pos);
+lwb (const char *str, const char *end, const char *pos) {
+    return (bos(str, end, pos) || !isword((unsigned char) pos[-1])) &&
+           !eos(str, end, pos) && isword((unsigned char) *pos);
 }
 
 int
-rwb (const char *str, const char *pos) {
-    return !bos(str, pos) && isword(pos[-1]) && !isword(*pos);
+rwb (const char *str, const char *end, const char *pos) {
+    return !bos(str, end, pos) && isword((unsigned char) pos[-1]) &&
+           (eos(str, end, pos) || !isword((unsigned char) *pos));
 }
 
 int
-wb (const char *str, const char *pos) {
-    return lwb(str, pos) || rwb(str, pos);
+wb (const char *str, const char *end, const char *pos) {
+    return lwb(str, end, pos) || rwb(str, end, pos);
 }
 
 int
-nwb (const char *str, const char *pos) {
-    return !wb(str, pos);
+nwb (const char *str, const char *end, const char *pos) {
+    return !wb(str, end, pos);
 }
 
+
+int
+prev_flags (int c) {
+    return (c == '\n' ? PREV_NL : 0) | (isword(c) ? PREV_WORD : 0);
+}
+
+/* Decides an assertion from the PrevFlags of the char before the
+position and the char after it, which is -1 at the end.  */
+int
+assert_context (int kind, int prev, int next) {
+    int pw = !!(prev & PREV_WORD), nw = next >= 0 && isword(next);
+    switch (kind) {
+        case ASSERT_BOS: return prev & PREV_BOS;
+        case ASSERT_BOL: return prev & (PREV_BOS | PREV_NL);
+        case ASSERT_EOS: return next < 0;
+        case ASSERT_EOL: return next < 0 || next == '\n';
+        case ASSERT_LWB: return !pw && nw;
+        case ASSERT_RWB: return pw && !nw;
+        case ASSERT_WB:  return pw != nw;
+        case ASSERT_NWB: return pw == nw;
+    }
+    return 0;
+}
+
+int (*assertions[]) (const char *str, const char *end, const char *pos) = {
+    bos, bol, eos, eol, lwb, rwb, wb, nwb
+};
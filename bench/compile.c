@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../rx.h"
+
+/*
+Times compiling regexes of 12,500 up to 100,000 atoms, of the shapes
+generated from blocklists: a long sequence, an alternation of words, and
+a sequence of char classes and quantified groups. Compiling should take
+time linear in the size of the regex, so each doubling of the atoms
+should roughly double the time, which the ratio column shows.
+*/
+
+static char *
+make_regex (int shape, int atoms) {
+    char *regex = malloc(atoms * 16 + 1), *pos = regex;
+    int i;
+    for (i = 0; i < atoms; i++) {
+        switch (shape) {
+            case 0:
+                pos += sprintf(pos, "%c", 'a' + i % 26);
+                break;
+            case 1:
+                pos += sprintf(pos, "%s%c%c", i % 3 ? "" : i ? " | " : "",
+                               'a' + i % 26, 'a' + i / 26 % 26);
+                break;
+            default:
+                pos += sprintf(pos, i % 2 ? "<[a..f]>" : "[x y?]+");
+                break;
+        }
+    }
+    *pos = 0;
+    return regex;
+}
+
+static double
+time_compile (const char *regex) {
+    clock_t start = clock();
+    Rx *rx = rx_new(regex);
+    double secs;
+    if (!rx) {
+        fprintf(stderr, "regex doesn't compile\n");
+        exit(1);
+    }
+    secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+    rx_free(rx);
+    return secs;
+}
+
+int
+main (int argc, char **argv) {
+    static const char *shapes[] = {"sequence", "alternation", "quantified"};
+    char *regex;
+    double secs, last;
+    int shape, atoms;
+    printf("%-12s %8s %10s %6s\n", "shape", "atoms", "seconds", "ratio");
+    for (shape = 0; shape < 3; shape++) {
+        last = 0;
+        for (atoms = 12500; atoms <= 100000; atoms *= 2) {
+            regex = make_regex(shape, atoms);
+            secs = time_compile(regex);
+            printf("%-12s %8d %10.4f", shapes[shape], atoms, secs);
+            if (last > 0)
+                printf(" %6.2f", secs / last);
+            printf("\n");
+            last = secs;
+            free(regex);
+        }
+    }
+    return 0;
+}
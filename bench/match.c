@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../rx.h"
+
+/*
+Times compiling and matching a catalogue of patterns, each against a
+generated corpus of the kind of lines it is meant for: log lines for
+literals, tokenizers, word lists and captures, lines of a's for nested
+quantifiers, and nested parentheses for <~~N> recursion. Every line is
+matched on its own, the way rxgrep does it, over and over until at
+least MIN_SECONDS have gone by.
+
+Each row has the pattern and corpus, how long the regex took to compile
+in microseconds, how many lines matched, the throughput in megabytes of
+lines per second and the average time per line in nanoseconds. The
+columns are separated by spaces and no field has spaces in it, so the
+output can be compared between versions with awk or a spreadsheet.
+*/
+
+#define MIN_SECONDS 0.2
+
+typedef struct {
+    char   *buf;
+    size_t  len;
+    size_t *lines;
+    size_t  nlines;
+} Corpus;
+
+typedef struct {
+    const char *name;
+    const char *regex;
+    int         corpus;
+    int         spans;
+} Pattern;
+
+enum {LOG, AS, PARENS};
+
+static const char *corpus_names[] = {"log", "as", "parens"};
+
+static const char *words =
+    "'alpha' | 'bravo' | 'charlie' | 'delta' | 'echo' | 'foxtrot' | "
+    "'golf' | 'hotel' | 'india' | 'juliett' | 'kilo' | 'lima' | 'mike' | "
+    "'november' | 'oscar' | 'papa' | 'quebec' | 'romeo' | 'sierra' | "
+    "'tango' | 'uniform' | 'victor' | 'whiskey' | 'xray' | 'yankee' | "
+    "'zulu' | 'timeout' | 'refused' | 'denied' | 'overflow'";
+
+static const Pattern patterns[] = {
+    {"literal",     "'ERROR'", LOG, 0},
+    {"rare",        "'zqxj'", LOG, 0},
+    {"tokenizer",   "<alpha>+ '=' <[\\w.]>+ \\s+ \\d+ 'ms'", LOG, 0},
+    {"classes",     "^ \\d ** 4 '-' \\d\\d '-' \\d\\d", LOG, 0},
+    {"words",       NULL, LOG, 0},
+    {"captures",    "(\\d+) '.' (\\d+) '.' (\\d+) '.' (\\d+) ' ' (\\w+) ' ' "
+                    "(\\S+)", LOG, 1},
+    {"nested",      "^ [a?] ** 20 a ** 20 $", AS, 0},
+    {"nested-miss", "^ [a?] ** 20 a ** 20 b", AS, 0},
+    {"recursion",   "('(' [<-[()]> | <~~0>]* ')') $", PARENS, 0},
+};
+
+#define NPATTERNS (sizeof patterns / sizeof patterns[0])
+
+static unsigned long seed = 1;
+
+static unsigned long
+rnd (unsigned long n) {
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return (seed >> 33) % n;
+}
+
+static void
+add_line (Corpus *c, size_t *size, const char *line) {
+    size_t n = strlen(line);
+    while (c->len + n + 1 > *size) {
+        *size = *size ? 2 * *size : 1 << 16;
+        c->buf = realloc(c->buf, *size);
+    }
+    memcpy(c->buf + c->len, line, n);
+    c->len += n;
+    c->buf[c->len++] = '\n';
+}
+
+/* Splits a corpus into lines, recording where each begins. The line
+ends at the newline before the next one begins.  */
+static void
+index_lines (Corpus *c) {
+    size_t i, n = 0;
+    for (i = 0; i < c->len; i++)
+        n += c->buf[i] == '\n';
+    c->lines = malloc((n + 1) * sizeof (size_t));
+    c->lines[0] = 0;
+    for (i = 0; i < c->len; i++) {
+        if (c->buf[i] == '\n')
+            c->lines[++c->nlines] = i + 1;
+    }
+}
+
+static void
+make_corpus (Corpus *c, int kind) {
+    static const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "ERROR"};
+    static const char *verbs[] = {"GET", "POST", "PUT", "DELETE"};
+    static const char *msgs[] = {"ok", "ok", "ok", "retry", "timeout",
+                                 "refused"};
+    char line[256];
+    size_t size = 0;
+    int i, j, n;
+    memset(c, 0, sizeof (Corpus));
+    for (i = 0; i < 40000; i++) {
+        switch (kind) {
+            case LOG:
+                sprintf(line, "2024-%02lu-%02lu %02lu:%02lu:%02lu %s "
+                        "%lu.%lu.%lu.%lu %s /api/v%lu/items/%lu "
+                        "user=u%lu status=%lu took=%lu.%lu %lums msg=%s",
+                        1 + rnd(12), 1 + rnd(28), rnd(24), rnd(60), rnd(60),
+                        levels[rnd(5)], rnd(256), rnd(256), rnd(256),
+                        rnd(256), verbs[rnd(4)], 1 + rnd(3), rnd(100000),
+                        rnd(5000), 200 + rnd(4) * 100, rnd(10), rnd(1000),
+                        rnd(3000), msgs[rnd(6)]);
+                break;
+            case AS:
+                n = 15 + rnd(30);
+                for (j = 0; j < n; j++)
+                    line[j] = 'a';
+                line[n] = 0;
+                break;
+            default:
+                for (j = 0, n = 0; j < 60; j++) {
+                    if (rnd(3) == 0 && n)
+                        line[j] = ')', n--;
+                    else if (rnd(2))
+                        line[j] = '(', n++;
+                    else
+                        line[j] = 'a' + rnd(26);
+                }
+                while (n-- > 0)
+                    line[j++] = ')';
+                line[j] = 0;
+                break;
+        }
+        add_line(c, &size, line);
+    }
+    index_lines(c);
+}
+
+static double
+now (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench (const Pattern *p, Corpus *c) {
+    RxSpan spans[8];
+    double start, compile, secs;
+    size_t i, matches, reps = 0, bytes = 0;
+    Rx *rx;
+    start = now();
+    rx = rx_new(p->regex ? p->regex : words);
+    compile = now() - start;
+    if (!rx) {
+        fprintf(stderr, "%s doesn't compile\n", p->name);
+        exit(1);
+    }
+    start = now();
+    do {
+        matches = 0;
+        for (i = 0; i < c->nlines; i++) {
+            const char *line = c->buf + c->lines[i];
+            size_t len = c->lines[i + 1] - c->lines[i] - 1;
+            if (p->spans)
+                matches += rx_exec(rx, line, len, spans, 8);
+            else
+                matches += rx_match_n(rx, line, len);
+        }
+        reps++;
+        bytes += c->len;
+    } while ((secs = now() - start) < MIN_SECONDS);
+    printf("%-12s %-7s %10.1f %8zu %10.2f %10.1f\n", p->name,
+           corpus_names[p->corpus], compile * 1e6, matches,
+           bytes / secs / 1e6, secs * 1e9 / (reps * c->nlines));
+    rx_free(rx);
+}
+
+int
+main (int argc, char **argv) {
+    Corpus corpora[3];
+    int i;
+    for (i = 0; i < 3; i++)
+        make_corpus(&corpora[i], i);
+    printf("%-12s %-7s %10s %8s %10s %10s\n", "pattern", "corpus",
+           "compile_us", "matches", "mb_per_s", "ns_per_line");
+    for (i = 0; i < NPATTERNS; i++) {
+        if (argc > 1 && !strstr(patterns[i].name, argv[1]))
+            continue;
+        bench(&patterns[i], &corpora[patterns[i].corpus]);
+    }
+    for (i = 0; i < 3; i++) {
+        free(corpora[i].buf);
+        free(corpora[i].lines);
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+Scanning a string for the first byte in or out of a set, 16 or 32
+bytes at a time. A ByteSet is made from the bitmap of a char class and
+holds the set in whichever forms the vector code wants: up to
+BYTESET_RANGES ranges of bytes, tested with two SSE2 instructions a
+range, and the two 16-byte tables of Muła's pshufb lookup, which can
+test any set at all and is used when the CPU has AVX2. Sets with more
+ranges than that on a CPU without AVX2 are scanned a byte at a time.
+
+Both scans are told where the string ends, so NUL is a byte like any
+other. The vector loops read whole aligned blocks, which can go past the
+end of the string but never into another page; AddressSanitizer doesn't
+know that, so it is told to leave them alone.
+*/
+
+#if defined(__x86_64__) || defined(__i386__) && defined(__SSE2__)
+#define BYTESET_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_ASAN __attribute__ ((no_sanitize_address))
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NO_ASAN __attribute__ ((no_sanitize_address))
+#endif
+#endif
+#ifndef NO_ASAN
+#define NO_ASAN
+#endif
+
+#define IN_SET(set, c) ((set)->bits[(c) >> 3] >> ((c) & 7) & 1)
+
+void
+byte_set_init (ByteSet *set, const unsigned char *bits) {
+    int c, lo;
+    memcpy(set->bits, bits, sizeof set->bits);
+    set->nranges = 0;
+    for (c = 0; c < 256; c++) {
+        if (!IN_SET(set, c))
+            continue;
+        for (lo = c; c < 255 && IN_SET(set, c + 1); c++)
+            ;
+        if (set->nranges < BYTESET_RANGES) {
+            set->lo[set->nranges] = lo;
+            set->width[set->nranges] = c - lo;
+        }
+        set->nranges++;
+    }
+    /* Row lo of table[0] has bit h set when (h << 4 | lo) is in the set,
+    for h below 8, table[1] the same for h from 8 on.  */
+    memset(set->table, 0, sizeof set->table);
+    for (c = 0; c < 256; c++) {
+        if (IN_SET(set, c))
+            set->table[c >> 7][c & 15] |= 1 << (c >> 4 & 7);
+    }
+}
+
+#ifdef BYTESET_SIMD
+
+/* A mask with bit i set when byte i of v is in the set.  */
+static unsigned int
+ranges_mask (const ByteSet *set, __m128i v) {
+    __m128i in = _mm_setzero_si128(), d, w;
+    int i;
+    for (i = 0; i < set->nranges; i++) {
+        d = _mm_sub_epi8(v, _mm_set1_epi8(set->lo[i]));
+        w = _mm_set1_epi8(set->width[i]);
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_max_epu8(d, w), w));
+    }
+    return _mm_movemask_epi8(in);
+}
+
+static int
+have_avx2 (void) {
+    /* Threads that get here at once all work out the same answer, so it
+    doesn't matter which of them stores it last.  */
+    static int avx2 = -1;
+    int have = __atomic_load_n(&avx2, __ATOMIC_RELAXED);
+    if (have < 0) {
+        __builtin_cpu_init();
+        have = __builtin_cpu_supports("avx2") != 0;
+        __atomic_store_n(&avx2, have, __ATOMIC_RELAXED);
+    }
+    return have;
+}
+
+__attribute__ ((target ("avx2")))
+static unsigned int
+table_mask (const ByteSet *set, __m256i v) {
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m256i lo_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) set->table[0]));
+    __m256i hi_table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) set->table[1]));
+    __m256i nibble = _mm256_set1_epi8(15);
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo_table, lo),
+                                     _mm256_shuffle_epi8(hi_table, lo), v);
+    __m256i bit = _mm256_shuffle_epi8(bits, hi);
+    return _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+}
+
+/* Returns the first byte from pos on that is in the set if in is set,
+or out of it if not, or end if there isn't one. pos is before end.  */
+__attribute__ ((target ("avx2"))) NO_ASAN
+static const char *
+scan_avx2 (const ByteSet *set, const char *pos, const char *end, int in) {
+    const __m256i *block = (const __m256i *) ((size_t) pos & ~(size_t) 31);
+    unsigned int skip = pos - (const char *) block, mask;
+    for (; (const char *) block < end; block++, skip = 0) {
+        mask = table_mask(set, _mm256_load_si256(block));
+        mask = (in ? mask : ~mask) & ~0U << skip;
+        if (mask) {
+            pos = (const char *) block + __builtin_ctz(mask);
+            return pos < end ? pos : end;
+        }
+    }
+    return end;
+}
+
+NO_ASAN
+static const char *
+scan_sse2 (const ByteSet *set, const char *pos, const char *end, int in) {
+    const __m128i *block = (const __m128i *) ((size_t) pos & ~(size_t) 15);
+    unsigned int skip = pos - (const char *) block, mask;
+    for (; (const char *) block < end; block++, skip = 0) {
+        mask = ranges_mask(set, _mm_load_si128(block));
+        mask = (in ? mask : ~mask & 0xffff) & ~0U << skip;
+        if (mask) {
+            pos = (const char *) block + __builtin_ctz(mask);
+            return pos < end ? pos : end;
+        }
+    }
+    return end;
+}
+
+#endif
+
+static const char *
+scan (const ByteSet *set, const char *pos, const char *end, int in) {
+    const unsigned char *s = (const unsigned char *) pos;
+    if (pos >= end)
+        return end;
+#ifdef BYTESET_SIMD
+    if (have_avx2())
+        return scan_avx2(set, pos, end, in);
+    if (set->nranges <= BYTESET_RANGES)
+        return scan_sse2(set, pos, end, in);
+#endif
+    while (s < (const unsigned char *) end && IN_SET(set, *s) != in)
+        s++;
+    return (const char *) s;
+}
+
+/* Returns the first byte from pos on that isn't in the set, which is
+end if they all are.  */
+const char *
+byte_set_span (const ByteSet *set, const char *pos, const char *end) {
+    return scan(set, pos, end, 0);
+}
+
+/* Returns the first byte from pos on that is in the set, or NULL if
+there isn't one before end.  */
+const char *
+byte_set_find (const ByteSet *set, const char *pos, const char *end) {
+    pos = scan(set, pos, end, 1);
+    return pos < end ? pos : NULL;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rxpriv.h"
+
+/*
+A cache of compiled regexes keyed by their text, for callers that get
+the same patterns over and over. rx_cache_get() hands out a regex and
+counts a reference to it, and rx_cache_release() gives the reference
+back. Entries are kept in a hash table and on a list in the order they
+were last gotten, and when the regexes take up more than the capacity,
+the least recently gotten ones that nobody holds are freed until they
+fit again. A regex that is held can't be freed, so the cache can go
+over its capacity for as long as it is.
+
+The footprint of a regex is its arena, its program and its full DFA if
+it has one. Lazy DFA states built while matching aren't counted, since
+they come and go and are bounded by the DFA's budget anyway.
+
+A regex is compiled without holding the lock, so that threads getting
+other patterns aren't held up by it. If two threads compile the same
+pattern at once, the second to finish frees its copy and takes the
+first's.
+*/
+
+typedef struct Entry Entry;
+struct Entry {
+    char         *regex;
+    unsigned int  hash;
+    Rx           *rx;
+    size_t        size;
+    int           refs;
+    Entry        *chain;
+    Entry        *prev;
+    Entry        *next;
+};
+
+struct RxCache {
+    pthread_mutex_t  lock;
+    size_t           capacity;
+    size_t           used;
+    Entry          **table;
+    int              size;
+    int              n;
+    Entry           *head;
+    Entry           *tail;
+    unsigned long    hits;
+    unsigned long    misses;
+    unsigned long    evictions;
+};
+
+static unsigned int
+hash_str (const char *str) {
+    unsigned int hash = 2166136261u;
+    for (; *str; str++)
+        hash = (hash ^ (unsigned char) *str) * 16777619u;
+    return hash;
+}
+
+/* Counts the scratch the regex keeps for matching as well: its Pike VM,
+and the budget of its lazy DFA, which fills up as it's used. The
+backtracker's stack grows with the string matched and isn't counted.  */
+static size_t
+footprint (Rx *rx) {
+    Prog *prog = rx->prog;
+    size_t size = rx->arena->total + sizeof (Prog) +
+                  prog->ninsts * (sizeof (Inst) + sizeof (int)) +
+                  prog->nclasses * (sizeof (CharClass *) + sizeof (ByteSet)) +
+                  prog->ncounters * sizeof (Counter) +
+                  prog->nloops * sizeof (Loop);
+    if (rx->full)
+        size += full_dfa_size(rx->full);
+    if (!prog_backtrack_only(prog)) {
+        size += pike_size(prog);
+        if (!rx->full)
+            size += rx->dfa_cache ? rx->dfa_cache : DFA_DEFAULT_BUDGET;
+    }
+    return size;
+}
+
+RxCache *
+rx_cache_new (size_t capacity) {
+    RxCache *cache = calloc(1, sizeof (RxCache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->capacity = capacity;
+    cache->size = 64;
+    cache->table = calloc(cache->size, sizeof (Entry *));
+    return cache;
+}
+
+static void
+entry_free (Entry *e) {
+    rx_free(e->rx);
+    free(e->regex);
+    free(e);
+}
+
+void
+rx_cache_free (RxCache *cache) {
+    Entry *e, *next;
+    if (!cache)
+        return;
+    for (e = cache->head; e; e = next) {
+        next = e->next;
+        entry_free(e);
+    }
+    free(cache->table);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static Entry *
+lookup (RxCache *cache, const char *regex, unsigned int hash) {
+    Entry *e;
+    for (e = cache->table[hash & (cache->size - 1)]; e; e = e->chain) {
+        if (e->hash == hash && !strcmp(e->regex, regex))
+            return e;
+    }
+    return NULL;
+}
+
+static void
+unlink_entry (RxCache *cache, Entry *e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void
+push_front (RxCache *cache, Entry *e) {
+    e->next = cache->head;
+    if (cache->head)
+        cache->head->prev = e;
+    else
+        cache->tail = e;
+    cache->head = e;
+}
+
+static void
+insert (RxCache *cache, Entry *e) {
+    Entry **table, *chain, *next;
+    int i;
+    if (cache->n == cache->size) {
+        table = calloc(2 * cache->size, sizeof (Entry *));
+        for (i = 0; i < cache->size; i++) {
+            for (chain = cache->table[i]; chain; chain = next) {
+                next = chain->chain;
+                chain->chain = table[chain->hash & (2 * cache->size - 1)];
+                table[chain->hash & (2 * cache->size - 1)] = chain;
+            }
+        }
+        free(cache->table);
+        cache->table = table;
+        cache->size *= 2;
+    }
+    e->chain = cache->table[e->hash & (cache->size - 1)];
+    cache->table[e->hash & (cache->size - 1)] = e;
+    cache->n++;
+    cache->used += e->size;
+    push_front(cache, e);
+}
+
+static void
+remove_entry (RxCache *cache, Entry *e) {
+    Entry **link = &cache->table[e->hash & (cache->size - 1)];
+    while (*link != e)
+        link = &(*link)->chain;
+    *link = e->chain;
+    unlink_entry(cache, e);
+    cache->n--;
+    cache->used -= e->size;
+    cache->evictions++;
+    entry_free(e);
+}
+
+/* Frees the least recently gotten regexes nobody holds until the rest
+fit in the capacity.  */
+static void
+evict (RxCache *cache) {
+    Entry *e, *prev;
+    for (e = cache->tail; e && cache->used > cache->capacity; e = prev) {
+        prev = e->prev;
+        if (!e->refs)
+            remove_entry(cache, e);
+    }
+}
+
+/* Returns the compiled regex, compiling it if it isn't in the cache, or
+NULL if it doesn't parse. Every regex gotten has to be given back with
+rx_cache_release(), and mustn't be freed with rx_free().  */
+Rx *
+rx_cache_get (RxCache *cache, const char *regex) {
+    unsigned int hash = hash_str(regex);
+    Entry *e, *found;
+    pthread_mutex_lock(&cache->lock);
+    if ((e = lookup(cache, regex, hash))) {
+        e->refs++;
+        cache->hits++;
+        unlink_entry(cache, e);
+        push_front(cache, e);
+        pthread_mutex_unlock(&cache->lock);
+        return e->rx;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    e = calloc(1, sizeof (Entry));
+    e->regex = strdupf("%s", regex);
+    e->hash = hash;
+    e->refs = 1;
+    if (!(e->rx = rx_new(e->regex))) {
+        free(e->regex);
+        free(e);
+        return NULL;
+    }
+    e->size = footprint(e->rx);
+
+    pthread_mutex_lock(&cache->lock);
+    if ((found = lookup(cache, regex, hash))) {
+        found->refs++;
+        unlink_entry(cache, found);
+        push_front(cache, found);
+        pthread_mutex_unlock(&cache->lock);
+        entry_free(e);
+        return found->rx;
+    }
+    insert(cache, e);
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return e->rx;
+}
+
+/* Gives back a regex gotten from the cache. Once nobody holds it, it can
+be freed to make room for others.  */
+void
+rx_cache_release (RxCache *cache, Rx *rx) {
+    Entry *e;
+    pthread_mutex_lock(&cache->lock);
+    e = lookup(cache, rx->regex, hash_str(rx->regex));
+    if (e && e->rx == rx && e->refs > 0) {
+        e->refs--;
+        if (!e->refs)
+            evict(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void
+rx_cache_stats (RxCache *cache, RxCacheStats *stats) {
+    pthread_mutex_lock(&cache->lock);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->regexes = cache->n;
+    stats->bytes = cache->used;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -11,39 +11,83 @@ character. For example, this character class:
 Means that a character must be punctuation, or alphabetical, but not in
 the range "a" through "f" or characters "x", "y", "z", and not a comma.
 
-In the code, it is represented backwards, because that is the order
-matching occurs in. In the above example, if its a comma, you can
-immediately tell the character is not in the class. If its not a comma,
-you check if its in the range "a" through "f", if it is, its not in
-the character class. Then if its an alphabetic, it is contained. If
-punctiation, it is, otherwise it is not a part of the character class.
+In the code, it is a flat array of actions, with each class that's
+combined in starting with whether it adds to the class or takes away
+from it. Every class whose actions match the character has its say,
+and the last one wins: for a comma, the last class says it's out. If
+nothing matches at all, the character is only in the class if the
+first thing written in it was an exclusion.
 
 The above, once parsed, will be a flat array like this:
 
-    [CC_EXCLUDES, CC_CHAR, ',',
-     CC_EXCLUDES, CC_RANGE, 'a', 'f', CC_CHAR, 'x', CC_CHAR, 'y', CC_CHAR, 'z',
+    [CC_INCLUDES, CC_FUNC, ispunct,
      CC_INCLUDES, CC_FUNC, isalpha,
-     CC_INCLUDES, CC_FUNC, ispunct]
+     CC_EXCLUDES, CC_RANGE, 'a', 'f', CC_CHAR, 'x', CC_CHAR, 'y', CC_CHAR, 'z',
+     CC_EXCLUDES, CC_CHAR, ',']
+
+Once the parser has built the whole array, char_class_compile() runs it
+for each of the 256 bytes and keeps the answers as a bitmap, so that at
+match time char_class_match() is just a load and a bit test.
 */
 
 CharClass *
 char_class_new (Rx *rx, const char *str, int length) {
-    CharClass *cc = calloc(1, sizeof (CharClass));
+    CharClass *cc = arena_alloc(rx->arena, sizeof (CharClass));
     cc->str = str;
     cc->length = length;
-    rx->charclasses = list_push(rx->charclasses, cc);
     return cc;
 }
 
-void
-char_class_free (CharClass *cc) {
-    if (cc)
-        list_free(cc->actions, NULL);
-    free(cc);
-}
-
 void
 char_class_print (CharClass *cc) {
     printf("%.*s\n", cc->length, cc->str);
 }
 
+static int
+char_class_eval (CharClass *cc, int c) {
+    void **elem = cc->actions.items, **end = elem + cc->actions.n;
+    int container = CC_INCLUDES, in, action, lo, hi;
+    int (*func) (int);
+    in = elem < end && POINTER_TO_INT(*elem) == CC_EXCLUDES;
+    while (elem < end) {
+        action = POINTER_TO_INT(*elem++);
+        switch (action) {
+            case CC_INCLUDES:
+            case CC_EXCLUDES:
+                container = action;
+                continue;
+            case CC_CHAR:
+            case CC_NCHAR:
+                lo = (unsigned char) POINTER_TO_INT(*elem++);
+                if ((c == lo) == (action == CC_CHAR))
+                    in = container == CC_INCLUDES;
+                break;
+            case CC_RANGE:
+                lo = (unsigned char) POINTER_TO_INT(elem[0]);
+                hi = (unsigned char) POINTER_TO_INT(elem[1]);
+                elem += 2;
+                if (c >= lo && c <= hi)
+                    in = container == CC_INCLUDES;
+                break;
+            case CC_FUNC:
+            case CC_NFUNC:
+                func = *elem++;
+                if (!func(c) == (action == CC_NFUNC))
+                    in = container == CC_INCLUDES;
+                break;
+        }
+    }
+    return in;
+}
+
+/* Folds the actions into the bitmap, which is all that's needed from
+then on.  */
+void
+char_class_compile (CharClass *cc) {
+    int c;
+    for (c = 0; c < 256; c++) {
+        if (char_class_eval(cc, c))
+            cc->bits[c >> 3] |= 1 << (c & 7);
+    }
+    cc->actions.n = 0;
+}
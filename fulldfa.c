@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+A DFA compiled all at once when the regex is created, for when matching
+the same regex over and over is worth paying for it up front. Every
+state the lazy DFA could ever build is built, then states that can't be
+told apart by any string are merged with Hopcroft's algorithm. What's
+left is a dense table with a row per state and a column per byte class.
+
+The rows are stored premultiplied by the number of byte classes, so
+each byte of input costs a load from the byte map and a load from the
+table. State 0 can never match and state 1 has already matched; both
+only go to themselves, so the loop just has to notice when it lands on
+one of them to stop early. Whenever it is back in the start state, it
+skips ahead to the next place a match could start.
+
+Programs with <~~N> calls have no DFA, and neither do programs that
+need more than the given number of states. rx_new_with() falls back to
+the other engines for those.
+*/
+
+struct FullDfa {
+    Prog          *prog;
+    int            nbytes;
+    unsigned char  bytemap[256];
+    int            nstates;
+    unsigned int  *table;
+    unsigned char *eos;
+    unsigned int   start;
+};
+
+/* How a DFA is saved by rx_serialize(): this, then the table, then the
+eos flags.  */
+typedef struct {
+    int            nbytes;
+    int            nstates;
+    unsigned int   start;
+    unsigned char  bytemap[256];
+} SavedDfa;
+
+typedef struct {
+    int  n;
+    int  k;
+    int *elems;
+    int *loc;
+    int *block;
+    int *first;
+    int *end;
+    int *mid;
+    int  nblocks;
+    int *touched;
+    int  ntouched;
+    int *work;
+    int  nwork;
+    char *inwork;
+} Partition;
+
+static void
+mark (Partition *p, int q) {
+    int b = p->block[q], i = p->loc[q], j = p->mid[b], r;
+    if (i < j)
+        return;
+    r = p->elems[j];
+    if (j == p->first[b])
+        p->touched[p->ntouched++] = b;
+    p->elems[j] = q;
+    p->loc[q] = j;
+    p->elems[i] = r;
+    p->loc[r] = i;
+    p->mid[b]++;
+}
+
+static void
+push_work (Partition *p, int b) {
+    if (p->inwork[b])
+        return;
+    p->inwork[b] = 1;
+    p->work[p->nwork++] = b;
+}
+
+/* Splits every touched block into its marked and unmarked states.  */
+static void
+split (Partition *p) {
+    int i, j, b, z;
+    for (i = 0; i < p->ntouched; i++) {
+        b = p->touched[i];
+        if (p->mid[b] == p->end[b]) {
+            p->mid[b] = p->first[b];
+            continue;
+        }
+        z = p->nblocks++;
+        p->first[z] = p->first[b];
+        p->end[z] = p->mid[z] = p->mid[b];
+        p->first[b] = p->mid[b];
+        p->mid[z] = p->first[z];
+        for (j = p->first[z]; j < p->end[z]; j++)
+            p->block[p->elems[j]] = z;
+        if (p->inwork[b] ||
+            p->end[z] - p->first[z] <= p->end[b] - p->first[b])
+            push_work(p, z);
+        else
+            push_work(p, b);
+    }
+    p->ntouched = 0;
+}
+
+/* Hopcroft's algorithm. Starting from the states split by whether they
+match at the end of the string, refines the groups until every state in
+a group goes to the same group on every byte class. Fills in block with
+the group of each state and returns how many groups there are. States
+that can never match end up with state 0, and states that have already
+matched with state 1.  */
+static int
+minimize (unsigned int *table, int n, int k, unsigned char *eos,
+          int *block) {
+    Partition p = {0};
+    int *count, *start, *preds, *members;
+    int q, c, i, j, a, nmembers, t;
+    p.n = n;
+    p.k = k;
+    p.elems = malloc(n * sizeof (int));
+    p.loc = malloc(n * sizeof (int));
+    p.block = block;
+    p.first = malloc(n * sizeof (int));
+    p.end = malloc(n * sizeof (int));
+    p.mid = malloc(n * sizeof (int));
+    p.touched = malloc(n * sizeof (int));
+    p.work = malloc(n * sizeof (int));
+    p.inwork = calloc(n, 1);
+    members = malloc(n * sizeof (int));
+
+    /* Predecessors of each state on each byte class.  */
+    count = calloc(k * (n + 1), sizeof (int));
+    start = count;
+    preds = malloc(k * n * sizeof (int));
+    for (q = 0; q < n; q++) {
+        for (c = 0; c < k; c++)
+            count[c * (n + 1) + table[q * k + c] + 1]++;
+    }
+    for (c = 0; c < k; c++) {
+        for (t = 0; t < n; t++)
+            count[c * (n + 1) + t + 1] += count[c * (n + 1) + t];
+    }
+    for (q = 0; q < n; q++) {
+        for (c = 0; c < k; c++) {
+            t = table[q * k + c];
+            preds[c * n + start[c * (n + 1) + t]++] = q;
+        }
+    }
+    for (c = 0; c < k; c++) {
+        for (t = n; t > 0; t--)
+            start[c * (n + 1) + t] = start[c * (n + 1) + t - 1];
+        start[c * (n + 1)] = 0;
+    }
+
+    /* The initial blocks: states that match at the end of the string and
+    states that don't. State 0 is in the second and state 1 in the first,
+    so neither is ever empty.  */
+    for (q = 0, i = 0; i < 2; i++) {
+        p.first[i] = p.mid[i] = q;
+        for (j = 0; j < n; j++) {
+            if (eos[j] != i)
+                continue;
+            p.elems[q] = j;
+            p.loc[j] = q;
+            block[j] = i;
+            q++;
+        }
+        p.end[i] = q;
+        push_work(&p, i);
+    }
+    p.nblocks = 2;
+
+    while (p.nwork) {
+        a = p.work[--p.nwork];
+        p.inwork[a] = 0;
+        nmembers = p.end[a] - p.first[a];
+        memcpy(members, p.elems + p.first[a], nmembers * sizeof (int));
+        for (c = 0; c < k; c++) {
+            for (i = 0; i < nmembers; i++) {
+                t = members[i];
+                for (j = start[c * (n + 1) + t];
+                     j < start[c * (n + 1) + t + 1]; j++)
+                    mark(&p, preds[c * n + j]);
+            }
+            split(&p);
+        }
+    }
+    free(p.elems);
+    free(p.loc);
+    free(p.first);
+    free(p.end);
+    free(p.mid);
+    free(p.touched);
+    free(p.work);
+    free(p.inwork);
+    free(members);
+    free(count);
+    free(preds);
+    return p.nblocks;
+}
+
+FullDfa *
+full_dfa_new (Prog *prog, int max) {
+    LazyDfa *lazy;
+    FullDfa *dfa;
+    unsigned int *table;
+    unsigned char *eos;
+    int *block, *number;
+    int n, nblocks, k = prog->nbytes, q, c, b;
+    if (prog_backtrack_only(prog))
+        return NULL;
+    lazy = lazy_dfa_new(prog, (size_t) -1);
+    n = lazy_dfa_expand(lazy, max, &table, &eos);
+    lazy_dfa_free(lazy);
+    if (n < 0)
+        return NULL;
+    block = malloc(n * sizeof (int));
+    nblocks = minimize(table, n, k, eos, block);
+
+    /* Number the blocks so that the ones holding states 0 and 1 stay 0
+    and 1.  */
+    number = malloc(nblocks * sizeof (int));
+    for (b = 0; b < nblocks; b++)
+        number[b] = -1;
+    number[block[0]] = 0;
+    number[block[1]] = 1;
+    dfa = calloc(1, sizeof (FullDfa));
+    dfa->prog = prog;
+    dfa->nbytes = k;
+    dfa->nstates = 2;
+    for (q = 2; q < n; q++) {
+        if (number[block[q]] < 0)
+            number[block[q]] = dfa->nstates++;
+    }
+    memcpy(dfa->bytemap, prog->bytemap, sizeof dfa->bytemap);
+    dfa->table = malloc(dfa->nstates * k * sizeof (unsigned int));
+    dfa->eos = malloc(dfa->nstates);
+    for (q = 0; q < n; q++) {
+        b = number[block[q]];
+        dfa->eos[b] = eos[q];
+        for (c = 0; c < k; c++)
+            dfa->table[b * k + c] = number[block[table[q * k + c]]] * k;
+    }
+    dfa->start = number[block[2]] * k;
+    free(block);
+    free(number);
+    free(table);
+    free(eos);
+    return dfa;
+}
+
+void
+full_dfa_free (FullDfa *dfa) {
+    if (!dfa)
+        return;
+    free(dfa->table);
+    free(dfa->eos);
+    free(dfa);
+}
+
+int
+full_dfa_states (FullDfa *dfa) {
+    return dfa->nstates;
+}
+
+/* The bytes the DFA takes up.  */
+size_t
+full_dfa_size (FullDfa *dfa) {
+    return sizeof (FullDfa) +
+           dfa->nstates * (dfa->nbytes * sizeof (unsigned int) + 1);
+}
+
+/* Writes the DFA to buf if it isn't NULL, and returns the bytes it
+takes.  */
+size_t
+full_dfa_save (FullDfa *dfa, char *buf) {
+    size_t table = dfa->nstates * dfa->nbytes * sizeof (unsigned int);
+    SavedDfa *saved = (SavedDfa *) buf;
+    if (buf) {
+        memset(saved, 0, sizeof (SavedDfa));
+        saved->nbytes = dfa->nbytes;
+        saved->nstates = dfa->nstates;
+        saved->start = dfa->start;
+        memcpy(saved->bytemap, dfa->bytemap, 256);
+        memcpy(buf + sizeof (SavedDfa), dfa->table, table);
+        memcpy(buf + sizeof (SavedDfa) + table, dfa->eos, dfa->nstates);
+    }
+    return sizeof (SavedDfa) + table + dfa->nstates;
+}
+
+/* Makes a DFA out of one saved at buf, using its table where it lies.
+The DFA is allocated from the arena, and isn't freed with
+full_dfa_free(). Returns NULL if the saved DFA doesn't fit in size
+bytes, or if its start, table or bytemap lead to anything but the start
+of a state.  */
+FullDfa *
+full_dfa_load (Prog *prog, const char *buf, size_t size, Arena *arena) {
+    const SavedDfa *saved = (const SavedDfa *) buf;
+    const unsigned int *table;
+    size_t i, n;
+    FullDfa *dfa;
+    if (size < sizeof (SavedDfa) || saved->nbytes <= 0 ||
+        saved->nbytes > 256 || saved->nstates < 2 ||
+        (size - sizeof (SavedDfa)) / (saved->nbytes * sizeof (unsigned int) + 1)
+        < saved->nstates)
+        return NULL;
+    n = (size_t) saved->nstates * saved->nbytes;
+    table = (const unsigned int *) (buf + sizeof (SavedDfa));
+    if (saved->start % saved->nbytes || saved->start >= n)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        if (table[i] % saved->nbytes || table[i] >= n)
+            return NULL;
+    }
+    for (i = 0; i < 256; i++) {
+        if (saved->bytemap[i] >= saved->nbytes)
+            return NULL;
+    }
+    dfa = arena_alloc(arena, sizeof (FullDfa));
+    dfa->prog = prog;
+    dfa->nbytes = saved->nbytes;
+    dfa->nstates = saved->nstates;
+    dfa->start = saved->start;
+    memcpy(dfa->bytemap, saved->bytemap, 256);
+    dfa->table = (unsigned int *) table;
+    dfa->eos = (unsigned char *) (buf + sizeof (SavedDfa)) +
+               n * sizeof (unsigned int);
+    return dfa;
+}
+
+int
+full_dfa_match (FullDfa *dfa, const char *str, size_t len) {
+    const unsigned char *pos = (const unsigned char *) str;
+    const unsigned char *end = pos + len;
+    const unsigned int *table = dfa->table;
+    const unsigned char *bytemap = dfa->bytemap;
+    unsigned int state = dfa->start, last = dfa->nbytes;
+    int skip = dfa->prog->skip;
+    for (; pos < end; pos++) {
+        if (skip && state == dfa->start &&
+            !(pos = (const unsigned char *) prog_find_start(
+                dfa->prog, (const char *) pos, (const char *) end)))
+            return 0;
+        state = table[state + bytemap[*pos]];
+        if (state <= last)
+            return state == last;
+    }
+    return dfa->eos[state / dfa->nbytes];
+}
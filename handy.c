@@ -10,9 +10,26 @@ strdupf (const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
     size = vsnprintf(NULL, 0, fmt, args) + 1;
+    va_end(args);
     str = malloc(size);
+    va_start(args, fmt);
     vsprintf(str, fmt, args);
     va_end(args);
     return str;
 }
 
+
+/* Returns ptr grown to hold at least want bytes, where *size is what it
+holds now. It doubles at least, so a buffer reused for bigger and bigger
+things stops being reallocated soon.  */
+void *
+grow (void *ptr, size_t *size, size_t want) {
+    size_t n = *size;
+    if (want <= n)
+        return ptr;
+    n = n ? 2 * n : 64;
+    while (n < want)
+        n *= 2;
+    *size = n;
+    return realloc(ptr, n);
+}
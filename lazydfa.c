@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+A DFA built on demand from the compiled program. A DFA state is the
+set of instructions that threads of the Pike VM would be at, plus what
+the previous char was, as far as assertions care. Its transition on a
+byte is worked out the first time it's needed and remembered, so in
+the common case matching is one table lookup per byte of input.
+
+The set of instructions in a state is the out of every instruction that
+ate the last char. Following the forks, jumps and assertions from there
+waits until the next char is known, so that assertions like $$ and >>
+can look at it. When following them reaches OP_MATCH the transition
+goes to DFA_MATCH, since all rx_match wants to know is whether there
+is a match. For the union of an RxSet, the OP_MATCH is kept in the state
+instead, and stays in every state after it, so that the state the end
+of the string is reached in holds the id of every regex that matched
+somewhere. Unless the program is anchored with ^, the start of the
+program is followed from every state, which is the same as starting a
+new match at every position.
+
+The states are kept in a cache with a fixed budget of memory. When a
+new state doesn't fit, the whole cache is flushed and built up again
+from the current position. If it fills up again before much more of the
+string has been read, building states costs more than it saves, so
+lazy_dfa_match() gives up and the caller falls back to the Pike VM.
+*/
+
+#define DFA_MATCH ((DState *) 1)
+#define DFA_DEAD  ((DState *) 2)
+#define DFA_FULL  ((DState *) 3)
+
+#define DFA_MIN_BYTES_PER_STATE 10
+
+typedef struct DState DState;
+struct DState {
+    unsigned int  flags;
+    unsigned int  npcs;
+    unsigned int *pcs;
+    unsigned int  hash;
+    int           eos;
+    int           id;
+    int           nmatched;
+    DState       *chain;
+    DState       *next[1];
+};
+
+struct LazyDfa {
+    Prog          *prog;
+    size_t         budget;
+    size_t         used;
+    DState       **table;
+    int            size;
+    int            nstates;
+    DState        *start;
+    unsigned int  *sparse;
+    unsigned int  *dense;
+    int            nvisited;
+    unsigned int  *stack;
+    unsigned int  *kernel;
+    int            nkernel;
+    unsigned char *ids;
+    unsigned long  hits;
+    unsigned long  misses;
+    unsigned long  flushes;
+};
+
+LazyDfa *
+lazy_dfa_new (Prog *prog, size_t budget) {
+    LazyDfa *dfa = calloc(1, sizeof (LazyDfa));
+    unsigned int pc, nids = 0;
+    dfa->prog = prog;
+    dfa->budget = budget ? budget : DFA_DEFAULT_BUDGET;
+    dfa->size = 64;
+    dfa->table = calloc(dfa->size, sizeof (DState *));
+    dfa->sparse = malloc(prog->ninsts * sizeof (unsigned int));
+    dfa->dense = malloc(prog->ninsts * sizeof (unsigned int));
+    dfa->stack = malloc((2 * prog->ninsts + 1) * sizeof (unsigned int));
+    dfa->kernel = malloc(prog->ninsts * sizeof (unsigned int));
+    if (prog->nmatches) {
+        for (pc = 0; pc < prog->ninsts; pc++) {
+            if (prog->insts[pc].op == OP_MATCH && prog->insts[pc].arg >= nids)
+                nids = prog->insts[pc].arg + 1;
+        }
+        dfa->ids = calloc(nids, 1);
+    }
+    return dfa;
+}
+
+static void
+lazy_dfa_flush (LazyDfa *dfa) {
+    DState *state, *chain;
+    int i;
+    for (i = 0; i < dfa->size; i++) {
+        for (state = dfa->table[i]; state; state = chain) {
+            chain = state->chain;
+            free(state);
+        }
+        dfa->table[i] = NULL;
+    }
+    dfa->nstates = 0;
+    dfa->used = 0;
+    dfa->start = NULL;
+}
+
+void
+lazy_dfa_free (LazyDfa *dfa) {
+    if (!dfa)
+        return;
+    lazy_dfa_flush(dfa);
+    free(dfa->table);
+    free(dfa->sparse);
+    free(dfa->dense);
+    free(dfa->stack);
+    free(dfa->kernel);
+    free(dfa->ids);
+    free(dfa);
+}
+
+void
+lazy_dfa_stats (LazyDfa *dfa, unsigned long *hits, unsigned long *misses,
+                unsigned long *flushes) {
+    *hits = dfa->hits;
+    *misses = dfa->misses;
+    *flushes = dfa->flushes;
+}
+
+static unsigned int
+state_hash (unsigned int flags, unsigned int *pcs, int npcs) {
+    unsigned int hash = 2166136261u ^ flags;
+    int i;
+    for (i = 0; i < npcs; i++)
+        hash = (hash ^ pcs[i]) * 16777619u;
+    return hash;
+}
+
+static size_t
+state_bytes (LazyDfa *dfa, int npcs) {
+    return sizeof (DState) + (dfa->prog->nbytes - 1) * sizeof (DState *) +
+           npcs * sizeof (unsigned int);
+}
+
+static void
+grow_table (LazyDfa *dfa) {
+    DState **table = dfa->table, *state, *chain;
+    int size = dfa->size, i;
+    dfa->size *= 2;
+    dfa->table = calloc(dfa->size, sizeof (DState *));
+    for (i = 0; i < size; i++) {
+        for (state = table[i]; state; state = chain) {
+            chain = state->chain;
+            state->chain = dfa->table[state->hash % dfa->size];
+            dfa->table[state->hash % dfa->size] = state;
+        }
+    }
+    free(table);
+}
+
+/* Counts the regexes of a set whose OP_MATCH is in the state. A regex
+can have several, one at the end of each alternative, so each id is
+only counted the first time it's seen.  */
+static void
+count_matched (LazyDfa *dfa, DState *state) {
+    Prog *prog = dfa->prog;
+    Inst *inst;
+    unsigned int i;
+    if (!prog->nmatches)
+        return;
+    for (i = 0; i < state->npcs; i++) {
+        inst = &prog->insts[state->pcs[i]];
+        if (inst->op == OP_MATCH && !dfa->ids[inst->arg]) {
+            dfa->ids[inst->arg] = 1;
+            state->nmatched++;
+        }
+    }
+    for (i = 0; i < state->npcs; i++) {
+        inst = &prog->insts[state->pcs[i]];
+        if (inst->op == OP_MATCH)
+            dfa->ids[inst->arg] = 0;
+    }
+}
+
+/* Finds the state with the given flags and sorted set of instructions,
+adding it if it's new. Returns DFA_FULL when it doesn't fit.  */
+static DState *
+find_state (LazyDfa *dfa, unsigned int flags, unsigned int *pcs, int npcs) {
+    unsigned int hash = state_hash(flags, pcs, npcs);
+    DState *state;
+    size_t bytes;
+    for (state = dfa->table[hash % dfa->size]; state; state = state->chain) {
+        if (state->hash == hash && state->flags == flags &&
+            state->npcs == npcs &&
+            (!npcs || !memcmp(state->pcs, pcs, npcs * sizeof (unsigned int))))
+            return state;
+    }
+    bytes = state_bytes(dfa, npcs);
+    if (dfa->used + bytes > dfa->budget)
+        return DFA_FULL;
+    if (dfa->nstates >= dfa->size)
+        grow_table(dfa);
+    state = calloc(1, bytes);
+    state->flags = flags;
+    state->npcs = npcs;
+    state->pcs = (unsigned int *) &state->next[dfa->prog->nbytes];
+    if (npcs)
+        memcpy(state->pcs, pcs, npcs * sizeof (unsigned int));
+    state->hash = hash;
+    state->eos = -1;
+    state->id = -1;
+    count_matched(dfa, state);
+    state->chain = dfa->table[hash % dfa->size];
+    dfa->table[hash % dfa->size] = state;
+    dfa->nstates++;
+    dfa->used += bytes;
+    return state;
+}
+
+static int
+visit (LazyDfa *dfa, unsigned int pc) {
+    unsigned int i = dfa->sparse[pc];
+    if (i < dfa->nvisited && dfa->dense[i] == pc)
+        return 0;
+    dfa->sparse[pc] = dfa->nvisited;
+    dfa->dense[dfa->nvisited++] = pc;
+    return 1;
+}
+
+static int
+step (Prog *prog, Inst *inst, int c) {
+    switch (inst->op) {
+        case OP_CHAR:  return c == inst->arg;
+        case OP_ANY:   return 1;
+        case OP_NCHAR: return c != inst->arg;
+        case OP_CLASS: return char_class_match(prog->classes[inst->arg], c);
+    }
+    return 0;
+}
+
+static int
+cmp_pc (const void *a, const void *b) {
+    unsigned int x = * (const unsigned int *) a, y = * (const unsigned int *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Follows everything that doesn't eat a char from the state's
+instructions, knowing that the next char is c, or -1 at the end. Returns
+1 if that reaches a match. Otherwise the outs of the instructions that
+would eat c are left, sorted, in dfa->kernel.  */
+static int
+closure (LazyDfa *dfa, DState *state, int c) {
+    Prog *prog = dfa->prog;
+    Inst *inst;
+    unsigned int pc, i;
+    int top = 0, n = 0;
+    dfa->nvisited = 0;
+    if (!prog->anchored || state->flags & PREV_BOS)
+        dfa->stack[top++] = prog->start;
+    for (i = state->npcs; i > 0; i--)
+        dfa->stack[top++] = state->pcs[i - 1];
+    while (top) {
+        pc = dfa->stack[--top];
+        if (!visit(dfa, pc))
+            continue;
+        inst = &prog->insts[pc];
+        switch (inst->op) {
+            case OP_MATCH:
+                if (!prog->nmatches)
+                    return 1;
+                dfa->kernel[n++] = pc;
+                break;
+            case OP_FORK:
+                for (i = inst->arg; i > 0; i--)
+                    dfa->stack[top++] = pc + i;
+                break;
+            case OP_JMP:
+            case OP_LOOP:
+            case OP_PROGRESS:
+            case OP_SAVE:
+                dfa->stack[top++] = inst->out;
+                break;
+            case OP_ASSERT:
+                if (assert_context(inst->arg, state->flags, c))
+                    dfa->stack[top++] = inst->out;
+                break;
+            case OP_CHAR:
+            case OP_ANY:
+            case OP_NCHAR:
+            case OP_CLASS:
+                if (c >= 0 && step(prog, inst, c))
+                    dfa->kernel[n++] = inst->out;
+                break;
+        }
+    }
+    qsort(dfa->kernel, n, sizeof (unsigned int), cmp_pc);
+    for (i = 0, dfa->nkernel = 0; i < n; i++) {
+        if (!i || dfa->kernel[i] != dfa->kernel[i - 1])
+            dfa->kernel[dfa->nkernel++] = dfa->kernel[i];
+    }
+    return 0;
+}
+
+static DState *
+transition (LazyDfa *dfa, DState *state, int c) {
+    if (closure(dfa, state, c))
+        return DFA_MATCH;
+    if (!dfa->nkernel && dfa->prog->anchored)
+        return DFA_DEAD;
+    return find_state(dfa, prev_flags(c), dfa->kernel, dfa->nkernel);
+}
+
+static int
+match_at_eos (LazyDfa *dfa, DState *state) {
+    if (state->eos < 0)
+        state->eos = closure(dfa, state, -1);
+    return state->eos;
+}
+
+#define SPECIAL(state) ((size_t) (state) <= (size_t) DFA_FULL)
+
+/* Runs the DFA over the string. While no match is under way, which is
+when the state has no pcs, it skips ahead to the next place a match
+could start, and adds the bytes it skipped to *skipped.  */
+static int
+run (LazyDfa *dfa, const char *str, const char *end, const char **fin,
+     size_t *skipped) {
+    Prog *prog = dfa->prog;
+    const char *pos, *flushed = NULL, *found;
+    int skip = prog->skip;
+    DState *state, *next;
+    unsigned char c;
+    state = dfa->start;
+    for (pos = str; pos < end; pos++) {
+        if (skip && !state->npcs) {
+            if (!(found = prog_find_start(prog, pos, end))) {
+                *skipped += end - pos;
+                *fin = end;
+                return 0;
+            }
+            *skipped += found - pos;
+            pos = found;
+        }
+        c = *pos;
+        next = state->next[prog->bytemap[c]];
+        if (SPECIAL(next)) {
+            *fin = pos + 1;
+            if (next == DFA_MATCH)
+                return 1;
+            if (next == DFA_DEAD)
+                return 0;
+            dfa->misses++;
+            next = transition(dfa, state, c);
+            if (next == DFA_FULL) {
+                /* The kernel of the new state is still in dfa->kernel,
+                flushing doesn't touch it.  */
+                if (flushed &&
+                    pos - flushed < DFA_MIN_BYTES_PER_STATE * dfa->nstates)
+                    return -1;
+                lazy_dfa_flush(dfa);
+                dfa->flushes++;
+                flushed = pos;
+                next = find_state(dfa, prev_flags(c), dfa->kernel,
+                                  dfa->nkernel);
+                if (next == DFA_FULL)
+                    return -1;
+            }
+            else {
+                state->next[prog->bytemap[c]] = next;
+            }
+            if (next == DFA_MATCH)
+                return 1;
+            if (next == DFA_DEAD)
+                return 0;
+        }
+        state = next;
+    }
+    *fin = pos;
+    return match_at_eos(dfa, state);
+}
+
+/* Returns whether the program matches anywhere in the string, or -1 if
+the cache thrashed and the DFA gave up.  */
+int
+lazy_dfa_match (LazyDfa *dfa, const char *str, size_t len) {
+    unsigned long misses = dfa->misses;
+    const char *fin = str;
+    size_t skipped = 0;
+    int retval;
+    if (!dfa->start)
+        dfa->start = find_state(dfa, PREV_BOS, NULL, 0);
+    if (dfa->start == DFA_FULL) {
+        dfa->start = NULL;
+        return -1;
+    }
+    retval = run(dfa, str, str + len, &fin, &skipped);
+    dfa->hits += (fin - str) - skipped - (dfa->misses - misses);
+    return retval;
+}
+
+/* Builds every state reachable from the start, as long as there are no
+more than max of them, for compiling the whole DFA ahead of time. The
+states are numbered from 2 in the order they're found, 0 being a state
+that can never match and 1 one that has already matched. *table gets
+the number of the next state for each state and byte class, and *eos
+whether each state matches at the end of the string. Returns the number
+of states, or -1 if there were too many.  */
+int
+lazy_dfa_expand (LazyDfa *dfa, int max, unsigned int **table,
+                 unsigned char **eos) {
+    Prog *prog = dfa->prog;
+    DState **order, *next;
+    unsigned char reps[256];
+    int nstates = 2, i, b;
+    /* The lowest byte in each class stands in for it.  */
+    for (b = 255; b >= 0; b--)
+        reps[prog->bytemap[b]] = b;
+    dfa->start = find_state(dfa, PREV_BOS, NULL, 0);
+    if (dfa->start == DFA_FULL || max < 3)
+        return -1;
+    order = malloc(max * sizeof (DState *));
+    *table = calloc(max * prog->nbytes, sizeof (unsigned int));
+    *eos = calloc(max, 1);
+    for (b = 0; b < prog->nbytes; b++)
+        (*table)[prog->nbytes + b] = 1;
+    (*eos)[1] = 1;
+    dfa->start->id = nstates;
+    order[nstates++] = dfa->start;
+    for (i = 2; i < nstates; i++) {
+        (*eos)[i] = match_at_eos(dfa, order[i]);
+        for (b = 0; b < prog->nbytes; b++) {
+            next = transition(dfa, order[i], reps[b]);
+            if (next == DFA_MATCH || next == DFA_DEAD) {
+                (*table)[i * prog->nbytes + b] = next == DFA_MATCH;
+                continue;
+            }
+            if (next == DFA_FULL || next->id < 0 && nstates == max) {
+                free(order);
+                free(*table);
+                free(*eos);
+                return -1;
+            }
+            if (next->id < 0) {
+                next->id = nstates;
+                order[nstates++] = next;
+            }
+            (*table)[i * prog->nbytes + b] = next->id;
+        }
+    }
+    free(order);
+    return nstates;
+}
+
+/* Runs the DFA of an RxSet's union over the whole string, or until every
+regex in it has matched, and sets matched[id] for each that did, which
+the caller has cleared. Returns how many did, or -1 if the cache
+thrashed and the DFA gave up.  */
+int
+lazy_dfa_match_set (LazyDfa *dfa, const char *str, size_t len,
+                    char *matched) {
+    Prog *prog = dfa->prog;
+    const char *pos, *end = str + len, *flushed = NULL, *found;
+    unsigned long misses = dfa->misses;
+    size_t skipped = 0;
+    DState *state, *next;
+    unsigned char c;
+    Inst *inst;
+    int i, n = 0;
+    if (!dfa->start)
+        dfa->start = find_state(dfa, PREV_BOS, NULL, 0);
+    if (dfa->start == DFA_FULL) {
+        dfa->start = NULL;
+        return -1;
+    }
+    state = dfa->start;
+    for (pos = str; pos < end && state->nmatched < prog->nmatches; pos++) {
+        if (prog->skip && !state->npcs) {
+            if (!(found = prog_find_start(prog, pos, end))) {
+                /* Nothing matched, and nothing can.  */
+                dfa->hits += (pos - str) - skipped - (dfa->misses - misses);
+                return 0;
+            }
+            skipped += found - pos;
+            pos = found;
+        }
+        c = *pos;
+        next = state->next[prog->bytemap[c]];
+        if (!next) {
+            dfa->misses++;
+            next = transition(dfa, state, c);
+            if (next == DFA_FULL) {
+                if (flushed &&
+                    pos - flushed < DFA_MIN_BYTES_PER_STATE * dfa->nstates)
+                    return -1;
+                lazy_dfa_flush(dfa);
+                dfa->flushes++;
+                flushed = pos;
+                next = find_state(dfa, prev_flags(c), dfa->kernel,
+                                  dfa->nkernel);
+                if (next == DFA_FULL)
+                    return -1;
+            }
+            else {
+                state->next[prog->bytemap[c]] = next;
+            }
+        }
+        state = next;
+    }
+    dfa->hits += (pos - str) - skipped - (dfa->misses - misses);
+    closure(dfa, state, -1);
+    for (i = 0; i < dfa->nkernel; i++) {
+        inst = &prog->insts[dfa->kernel[i]];
+        if (inst->op == OP_MATCH && !matched[inst->arg]) {
+            matched[inst->arg] = 1;
+            n++;
+        }
+    }
+    return n;
+}
@@ -2,83 +2,651 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
 #include "rxpriv.h"
 
+/*
+The backtracker runs the program in a loop, and keeps what it has to
+come back to on a stack of its own rather than on the C stack, so a long
+string can't overflow the stack of a thread, however small. Each fork
+pushes the alternatives it has left, and each instruction that changes
+something a later alternative mustn't see, like OP_SAVE storing a
+position, pushes what it changed. When the path being followed fails,
+entries are popped, and what they changed put back, until one has an
+alternative left, which is followed from the instruction and position it
+holds. The stack is kept in a Backtrack and grows as needed, up to the
+stack_limit of the program; a match that needs more than that gives up
+and returns -1.
+
+Backtracking can try the same instruction at the same place in the
+string over and over, which takes exponential time on regexes like
+[a?] ** 30 a ** 30. When the string is short enough, a bitmap with a bit
+per instruction and offset remembers every pair already tried. Since
+the first path to reach MATCH wins, a pair that is reached again must
+have failed the first time, so the second visit can fail straight away,
+and the whole match takes time proportional to the size of the bitmap.
+
+Two things make the outcome of a pair depend on more than the pair.
+An OP_PROGRESS fails a loop body that matched nothing, so a pair reached
+at the offset where the innermost loop iteration began is never looked
+up. And the body of a <~~N> call ends in OP_RET, which succeeds without
+ending the match, so pairs inside calls aren't looked up either.
+
+A call pushes a frame with where to go on from, and OP_RET pops
+everything above the frame, since a call only ever returns the first
+way it matches. So what a call does depends only on the rule called
+and the offset it's called at, and like a packrat parser, a table with
+a cell for each of those remembers where the call returned, or that it
+failed. Each rule's body then runs at most once per offset, however
+many paths call it there, which keeps a grammar like
+['a' <~~0>? 'b' | 'a' <~~0>? 'c'] from taking exponential time. The
+table doesn't depend on the bitmap, but it isn't kept when it would
+have more than PACKRAT_MAX_CELLS cells.
+
+Inside a counted loop, what a pair does depends on the count as well.
+OP_COUNT keeps the count it starts over from in case the loop is reached
+again, and OP_REPEAT tries going round again and leaving in the order
+the bounds say, putting the count back when they fail. While only one
+counted loop is going, each pair is looked up with its count in a hash
+table instead of the bitmap, which holds at most COUNTED_MAX_SEEN of
+them; inside nested counted loops nothing is looked up.
+
+A fork with two alternatives, one of which eats a char and comes back
+to the fork, is a run like <alpha>* or .*? that would otherwise push an
+entry per char. Instead the run is eaten in a loop, and a single entry
+tries the other alternative at each place in the run in turn. When
+there is no bitmap, the end of a greedy run is found with
+byte_set_span() or memchr(). With a bitmap, the run has to stop at the
+first place the fork was already tried, so it is eaten a char at a time.
+
+When the caller wants to know where the groups matched, an OP_SAVE
+stores the place it was reached in a slot, so the slots hold the
+positions along the path that matched. Calls keep their groups to
+themselves.
+
+The bitmap and the other tables are kept in a Backtrack too, which an
+RxScratch holds on to between matches so they only need allocating
+when a longer string than before comes along.
+*/
+
+#define BITSTATE_MAX_BITS (1 << 21)
+#define COUNTED_MAX_SEEN (1 << 18)
+#define PACKRAT_MAX_CELLS (1 << 24)
+#define STACK_LIMIT (256 << 20)
+
+/* What an entry on the stack is for: an alternative left to try, or
+something to put back.  */
+typedef enum {
+    BT_FORK, BT_RUN, BT_FRUGAL, BT_REPEAT, BT_CALL,
+    BT_SAVE, BT_LOOP, BT_COUNT, BT_ROUND, BT_LEAVE
+} EntryKind;
+
+struct StackEntry {
+    EntryKind     kind;
+    unsigned int  pc;
+    unsigned int  arg;
+    int           n;
+    const char   *pos;
+    const char   *old;
+};
+
 typedef struct {
-    Rx *rx;
+    Prog *prog;
     const char *str;
+    const char *end;
     const char *beg;
-    const char *fin;
+    const char **loops;
+    const char *loop;
+    unsigned char *visited;
+    int *calls;
+    int *callslot;
+    unsigned int *counts;
+    int *outer;
+    int counting;
+    int counter;
+    unsigned long long *seen;
+    size_t nseen;
+    size_t seenslots;
+    Backtrack *bt;
+    StackEntry *stack;
+    int top;
+    int size;
+    int limit;
+    int frame;
+    int overflow;
+    const char **slots;
+    int nslots;
+    size_t len;
+    int depth;
 } Match;
 
-static int match_state ();
+static void
+match_trace (Match *m, unsigned int pc, const char *pos) {
+    printf("matching %.*s\e[1;32m%.*s\e[0m%.*s at %u\n",
+        (int) (m->beg - m->str), m->str, (int) (pos - m->beg), m->beg,
+        (int) (m->end - pos), pos, pc);
+}
 
+/* Returns whether the pair was already tried with the count the
+innermost counted loop is at, marking it tried if there's room.  */
 static int
-match_quantified (Match *m, State *g, State *b, Quantified *q, int n,
-                  const char *pos, const char **fin) {
-    for (; n < q->min; n++) {
-        if (!match_state(m, g, pos, &pos))
+counted_visited (Match *m, size_t bit) {
+    unsigned long long key, *seen;
+    size_t i, j, slots;
+    key = ((unsigned long long) bit << 32 | m->counts[m->counter]) + 1;
+    if (2 * (m->nseen + 1) > m->seenslots) {
+        if (m->seenslots >= 2 * COUNTED_MAX_SEEN)
             return 0;
+        slots = m->seenslots ? 2 * m->seenslots : 1024;
+        seen = calloc(slots, sizeof (unsigned long long));
+        for (i = 0; i < m->seenslots; i++) {
+            if (!m->seen[i])
+                continue;
+            for (j = m->seen[i] * 0x9e3779b97f4a7c15ULL >> 20 & (slots - 1);
+                 seen[j]; j = (j + 1) & (slots - 1))
+                ;
+            seen[j] = m->seen[i];
+        }
+        free(m->seen);
+        m->seen = m->bt->seen = seen;
+        m->seenslots = slots;
+        m->bt->seensize = slots * sizeof (unsigned long long);
+    }
+    for (i = key * 0x9e3779b97f4a7c15ULL >> 20 & (m->seenslots - 1);
+         m->seen[i]; i = (i + 1) & (m->seenslots - 1)) {
+        if (m->seen[i] == key)
+            return 1;
     }
-    if (q->max && n >= q->max)
-        return match_state(m, b, pos, fin);
-    return match_state(m, g, pos, fin) &&
-           match_quantified(m, g, b, q, n + 1, *fin, fin) ||
-           match_state(m, b, pos, fin);
+    m->seen[i] = key;
+    m->nseen++;
+    return 0;
 }
 
+/* Returns whether pc was already tried at pos, marking it tried if it
+can be.  */
 static int
-match_char (Match *m, State *state, char c, int eat, const char *pos, const char **fin) {
-    if (c != *pos)
+visited (Match *m, unsigned int pc, const char *pos) {
+    size_t bit;
+    if (!m->visited || m->depth || pos == m->loop)
         return 0;
-    if (eat)
-        pos++;
-    return match_state(m, state, pos, fin);
+    bit = pc * (m->len + 1) + (pos - m->str);
+    if (m->counting)
+        return m->counting == 1 && counted_visited(m, bit);
+    if (m->visited[bit >> 3] & 1 << (bit & 7))
+        return 1;
+    m->visited[bit >> 3] |= 1 << (bit & 7);
+    return 0;
 }
 
 static int
-match_transition (Match *m, Transition *t, const char *pos, const char **fin) {
-    if (t->type & QUANTIFIED)
-        return match_quantified(m, t->to, t->ret, t->param, 0, pos, fin);
-    else if (t->ret)
-        return match_state(m, t->to, pos, fin) &&
-               match_state(m, t->ret, *fin, fin);
-    else if (t->type & CHAR)
-        return match_char(
-            m, t->to, POINTER_TO_INT(t->param), t->type & EAT, pos, fin);
-    else if (!t->type)
-        return match_state(m, t->to, pos, fin);
-    printf("unrecognized transition type %d\n", t->type);
+eats (Match *m, Inst *inst, const char *pos) {
+    unsigned char c;
+    if (pos == m->end)
+        return 0;
+    c = *pos;
+    switch (inst->op) {
+        case OP_CHAR:  return c == inst->arg;
+        case OP_ANY:   return 1;
+        case OP_NCHAR: return c != inst->arg;
+        default:       return char_class_match(
+                                  m->prog->classes[inst->arg], c);
+    }
+}
+
+/* Returns where the run of chars inst eats from pos on ends.  */
+static const char *
+run_end (Match *m, Inst *inst, const char *pos) {
+    const char *end;
+    switch (inst->op) {
+        case OP_CLASS:
+            return byte_set_span(&m->prog->sets[inst->arg], pos, m->end);
+        case OP_ANY:
+            return m->end;
+        case OP_NCHAR:
+            end = memchr(pos, inst->arg, m->end - pos);
+            return end ? end : m->end;
+        default:
+            while (pos < m->end && (unsigned char) *pos == inst->arg)
+                pos++;
+            return pos;
+    }
+}
+
+static int
+is_run (Prog *prog, unsigned int fork, unsigned int pc) {
+    Inst *inst = &prog->insts[pc];
+    return inst->out == fork && (inst->op == OP_CHAR || inst->op == OP_ANY ||
+           inst->op == OP_NCHAR || inst->op == OP_CLASS);
+}
+
+/* Pushes an entry, growing the stack if there's room to, and returns it,
+or NULL if the stack is as big as it may get.  */
+static StackEntry *
+push (Match *m, EntryKind kind, unsigned int pc, const char *pos) {
+    StackEntry *e;
+    if (m->top == m->size) {
+        if (m->size >= m->limit) {
+            m->overflow = 1;
+            return NULL;
+        }
+        m->size = m->size ? 2 * m->size : 64;
+        if (m->size > m->limit)
+            m->size = m->limit;
+        m->stack = m->bt->stack = realloc(m->bt->stack,
+                                          m->size * sizeof (StackEntry));
+        m->bt->stacksize = m->size * sizeof (StackEntry);
+    }
+    e = &m->stack[m->top++];
+    e->kind = kind;
+    e->pc = pc;
+    e->pos = pos;
+    return e;
+}
+
+/* Puts back what an entry changed, if it changed anything.  */
+static void
+undo (Match *m, StackEntry *e) {
+    switch (e->kind) {
+        case BT_SAVE:
+            m->slots[e->arg] = e->old;
+            break;
+        case BT_LOOP:
+            m->loops[e->arg] = e->pos;
+            m->loop = e->old;
+            break;
+        case BT_COUNT:
+            m->counting--;
+            m->counter = m->outer[e->arg];
+            m->outer[e->arg] = e->n;
+            m->counts[e->arg] = e->pc;
+            break;
+        case BT_ROUND:
+            m->counts[e->arg]--;
+            break;
+        case BT_LEAVE:
+            m->counter = e->arg;
+            m->counting++;
+            break;
+        case BT_CALL:
+            m->depth--;
+            m->frame = e->n;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Goes round the counted loop at pc once more, or leaves it, whichever
+the bounds allow, in the order they say, starting from the i-th of the
+two. Leaves an entry to try the other if it's allowed too.  */
+static int
+repeat (Match *m, unsigned int pc, const char *pos, int i,
+        unsigned int *next) {
+    Inst *inst = &m->prog->insts[pc];
+    Counter *counter = &m->prog->counters[inst->arg];
+    StackEntry *e;
+    int can[2];
+    can[counter->frugal] = m->counts[inst->arg] < counter->max;
+    can[!counter->frugal] = m->counts[inst->arg] >= counter->min;
+    for (; i < 2 && !can[i]; i++)
+        ;
+    if (i == 2)
+        return 0;
+    if (!i && can[1]) {
+        if (!(e = push(m, BT_REPEAT, pc, pos)))
+            return 0;
+        e->arg = 1;
+    }
+    if (i == counter->frugal) {
+        if (!(e = push(m, BT_ROUND, pc, pos)))
+            return 0;
+        m->counts[inst->arg]++;
+        *next = pc + 1;
+    }
+    else {
+        if (!(e = push(m, BT_LEAVE, pc, pos)))
+            return 0;
+        m->counting--;
+        m->counter = m->outer[inst->arg];
+        *next = inst->out;
+    }
+    e->arg = inst->arg;
+    return 1;
+}
+
+/* Pops entries, putting back what they changed, until one has an
+alternative left, and sets pc and pos to it. Returns 0 if none has.  */
+static int
+backtrack (Match *m, unsigned int *pc, const char **pos) {
+    StackEntry *e;
+    Inst *inst;
+    while (m->top && !m->overflow) {
+        e = &m->stack[m->top - 1];
+        switch (e->kind) {
+            case BT_FORK:
+                inst = &m->prog->insts[e->pc];
+                *pc = e->pc + e->arg;
+                *pos = e->pos;
+                if (++e->arg > inst->arg)
+                    m->top--;
+                return 1;
+            case BT_RUN:
+                *pc = e->pc;
+                *pos = e->pos;
+                if (e->pos == e->old)
+                    m->top--;
+                else
+                    e->pos--;
+                return 1;
+            case BT_FRUGAL:
+                inst = &m->prog->insts[e->pc];
+                if (!eats(m, inst + 2, e->pos) ||
+                    visited(m, e->pc, e->pos + 1)) {
+                    m->top--;
+                    break;
+                }
+                *pc = e->pc + 1;
+                *pos = ++e->pos;
+                return 1;
+            case BT_REPEAT:
+                m->top--;
+                *pos = e->pos;
+                if (repeat(m, e->pc, *pos, e->arg, pc))
+                    return 1;
+                break;
+            default:
+                undo(m, e);
+                m->top--;
+                break;
+        }
+    }
     return 0;
 }
 
+/* Returns from the call whose frame is on top, putting back what was
+changed inside it and dropping the alternatives it left.  */
+static unsigned int
+ret (Match *m, const char *pos) {
+    StackEntry *e;
+    while (m->top - 1 > m->frame) {
+        undo(m, &m->stack[m->top - 1]);
+        m->top--;
+    }
+    e = &m->stack[--m->top];
+    m->depth--;
+    m->frame = e->n;
+    if (m->calls)
+        m->calls[m->callslot[e->arg] * (m->len + 1) + (e->pos - m->str)] =
+            pos - m->str;
+    return e->pc;
+}
+
+/* Carries out the instruction at pc, moving pc and pos on past it.
+Returns 0 if it fails, 2 if it ends the match and 1 otherwise.  */
 static int
-match_state (Match *m, State *state, const char *pos, const char **fin) {
-    List *elem;
-    printf("matching %.*s\e[1;32m%.*s\e[0m%s\n",
-        m->beg - m->str, m->str, pos - m->beg, m->beg, pos);
-    if (!state->transitions) {
-        *fin = pos;
-        return 1;
+step (Match *m, unsigned int *pc, const char **pos) {
+    Inst *inst = &m->prog->insts[*pc];
+    StackEntry *e;
+    const char *end;
+    int *call;
+    switch (inst->op) {
+        case OP_MATCH:
+            return 2;
+        case OP_RET:
+            if (m->frame < 0)
+                return 2;
+            *pc = ret(m, *pos);
+            return 1;
+        case OP_FORK:
+            if (inst->arg == 2 && is_run(m->prog, *pc, *pc + 1)) {
+                if (!m->visited || m->depth) {
+                    end = run_end(m, inst + 1, *pos);
+                }
+                else {
+                    for (end = *pos; eats(m, inst + 1, end) &&
+                                     !visited(m, *pc, end + 1); end++)
+                        ;
+                }
+                if (end > *pos) {
+                    if (!(e = push(m, BT_RUN, *pc + 2, end - 1)))
+                        return 0;
+                    e->old = *pos;
+                }
+                *pc += 2;
+                *pos = end;
+                return 1;
+            }
+            if (inst->arg == 2 && is_run(m->prog, *pc, *pc + 2)) {
+                if (!push(m, BT_FRUGAL, *pc, *pos))
+                    return 0;
+                *pc += 1;
+                return 1;
+            }
+            if (!(e = push(m, BT_FORK, *pc, *pos)))
+                return 0;
+            e->arg = 2;
+            *pc += 1;
+            return 1;
+        case OP_JMP:
+            break;
+        case OP_CHAR:
+        case OP_ANY:
+        case OP_NCHAR:
+        case OP_CLASS:
+            if (!eats(m, inst, *pos))
+                return 0;
+            ++*pos;
+            break;
+        case OP_ASSERT:
+            if (!assertions[inst->arg](m->str, m->end, *pos))
+                return 0;
+            break;
+        case OP_CALL:
+            if (m->calls) {
+                /* -2 is a call not yet made, -1 one that failed or is
+                still being made at this offset.  */
+                call = &m->calls[m->callslot[inst->arg] * (m->len + 1) +
+                                 (*pos - m->str)];
+                if (*call == -1)
+                    return 0;
+                if (*call >= 0) {
+                    *pos = m->str + *call;
+                    break;
+                }
+                *call = -1;
+            }
+            if (!(e = push(m, BT_CALL, inst->out, *pos)))
+                return 0;
+            e->arg = inst->arg;
+            e->n = m->frame;
+            m->frame = m->top - 1;
+            m->depth++;
+            *pc = inst->arg;
+            return 1;
+        case OP_LOOP:
+            if (!(e = push(m, BT_LOOP, *pc, m->loops[inst->arg])))
+                return 0;
+            e->arg = inst->arg;
+            e->old = m->loop;
+            m->loops[inst->arg] = m->loop = *pos;
+            break;
+        case OP_PROGRESS:
+            if (m->loops[inst->arg] == *pos)
+                return 0;
+            break;
+        case OP_SAVE:
+            if (m->depth || inst->arg + 2 >= m->nslots)
+                break;
+            if (!(e = push(m, BT_SAVE, *pc, *pos)))
+                return 0;
+            e->arg = inst->arg + 2;
+            e->old = m->slots[inst->arg + 2];
+            m->slots[inst->arg + 2] = *pos;
+            break;
+        case OP_COUNT:
+            if (!(e = push(m, BT_COUNT, m->counts[inst->arg], *pos)))
+                return 0;
+            e->arg = inst->arg;
+            e->n = m->outer[inst->arg];
+            m->counts[inst->arg] = 0;
+            m->outer[inst->arg] = m->counter;
+            m->counter = inst->arg;
+            m->counting++;
+            break;
+        case OP_REPEAT:
+            return repeat(m, *pc, *pos, 0, pc);
+        default:
+            return 0;
     }
-    for (elem = state->transitions; elem; elem = elem->next) {
-        if (match_transition(m, elem->data, pos, fin))
+    *pc = inst->out;
+    return 1;
+}
+
+/* Runs the program from pc, backtracking through forks in order, and
+returns 1 at the first OP_MATCH reached, 0 if there's none, or -1 if
+the stack got too big to tell.  */
+static int
+match_inst (Match *m, unsigned int pc, const char *pos, const char **fin) {
+    int retval;
+    m->top = 0;
+    m->frame = -1;
+    while (1) {
+        if (m->prog->debug)
+            match_trace(m, pc, pos);
+        retval = visited(m, pc, pos) ? 0 : step(m, &pc, &pos);
+        if (retval == 2) {
+            *fin = pos;
             return 1;
+        }
+        if (!retval && !backtrack(m, &pc, &pos))
+            return m->overflow ? -1 : 0;
     }
-    return 0;
 }
 
+/* Sets up the bitmap of instructions and offsets already tried, if the
+string is short enough.  */
+static void
+bitstate_new (Match *m, Backtrack *bt) {
+    Prog *prog = m->prog;
+    size_t size;
+    if ((m->len + 1) > BITSTATE_MAX_BITS / prog->ninsts)
+        return;
+    size = (prog->ninsts * (m->len + 1) + 7) / 8;
+    m->visited = bt->visited = grow(bt->visited, &bt->visitedsize, size);
+    memset(m->visited, 0, size);
+}
+
+/* Sets up the table of where each rule called returned for each offset,
+if it isn't too big.  */
+static void
+packrat_new (Match *m, Backtrack *bt) {
+    Prog *prog = m->prog;
+    unsigned int pc;
+    int n = 0;
+    size_t i;
+    m->callslot = bt->callslot = grow(bt->callslot, &bt->callslotsize,
+                                      prog->ninsts * sizeof (int));
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        if (prog->insts[pc].op == OP_CALL)
+            m->callslot[prog->insts[pc].arg] = -1;
+    }
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        if (prog->insts[pc].op == OP_CALL &&
+            m->callslot[prog->insts[pc].arg] < 0)
+            m->callslot[prog->insts[pc].arg] = n++;
+    }
+    if (!n || (m->len + 1) > PACKRAT_MAX_CELLS / n)
+        return;
+    m->calls = bt->calls = grow(bt->calls, &bt->callsize,
+                                n * (m->len + 1) * sizeof (int));
+    for (i = 0; i < n * (m->len + 1); i++)
+        m->calls[i] = -2;
+}
+
+/* Tries the program at each position of the string in turn and stops at
+the first one where it matches. slots[0] and slots[1] get where the
+match begins and ends, and the rest of the nslots slots where the groups
+saved by OP_SAVE did, or NULL for the ones the match didn't go through.
+The tables are kept in bt, or only for this match if it's NULL. Returns
+-1 if the stack would have had to grow past the program's limit.  */
 int
-rx_match (Rx *rx, const char *str) {
-    Match *m = calloc(1, sizeof (Match));
-    int retval;
-    m->rx = rx;
-    m->str = str;
-    for (m->beg = str; *m->beg; m->beg++) {
-        retval = match_state(m, rx->start, m->beg, &m->fin);
-        if (retval)
+backtrack_exec (Prog *prog, const char *str, size_t len, const char **slots,
+                int nslots, Backtrack *bt) {
+    Backtrack tmp = {0};
+    Match m = {0};
+    const char *fin;
+    size_t limit;
+    int retval = 0, i;
+    m.prog = prog;
+    m.str = str;
+    m.end = str + len;
+    m.len = len;
+    m.slots = slots;
+    m.nslots = nslots;
+    for (i = 0; i < nslots; i++)
+        slots[i] = NULL;
+    if (!bt)
+        bt = &tmp;
+    if (prog->nloops) {
+        m.loops = bt->loops = grow(bt->loops, &bt->loopsize,
+                                   prog->nloops * sizeof (const char *));
+        memset(m.loops, 0, prog->nloops * sizeof (const char *));
+    }
+    m.bt = bt;
+    m.stack = bt->stack;
+    m.size = bt->stacksize / sizeof (StackEntry);
+    limit = (prog->stack_limit ? prog->stack_limit : STACK_LIMIT) /
+            sizeof (StackEntry);
+    m.limit = limit < INT_MAX ? limit : INT_MAX;
+    bitstate_new(&m, bt);
+    if (prog->ncalls)
+        packrat_new(&m, bt);
+    if (prog->ncounters) {
+        m.counts = bt->counts = grow(bt->counts, &bt->countsize,
+                                     prog->ncounters * sizeof (unsigned int));
+        m.outer = bt->outer = grow(bt->outer, &bt->outersize,
+                                   prog->ncounters * sizeof (int));
+        m.seen = bt->seen;
+        m.seenslots = bt->seensize / sizeof (unsigned long long);
+        if (m.visited && m.seen)
+            memset(m.seen, 0, bt->seensize);
+    }
+    for (m.beg = str; ; m.beg++) {
+        if (prog->skip &&
+            !(m.beg = prog_find_start(prog, m.beg, m.end)))
+            break;
+        retval = match_inst(&m, prog->start, m.beg, &fin);
+        if (retval || m.beg == m.end)
             break;
     }
+    if (retval > 0) {
+        slots[0] = m.beg;
+        slots[1] = fin;
+    }
+    backtrack_free(&tmp);
     return retval;
 }
 
+void
+backtrack_free (Backtrack *bt) {
+    free(bt->loops);
+    free(bt->visited);
+    free(bt->calls);
+    free(bt->callslot);
+    free(bt->counts);
+    free(bt->outer);
+    free(bt->seen);
+    free(bt->stack);
+}
+
+int
+backtrack_match (Prog *prog, const char *str, size_t len,
+                 const char **beg, const char **end) {
+    const char *slots[2];
+    int retval = backtrack_exec(prog, str, len, slots, 2, NULL);
+    if (retval <= 0)
+        return retval;
+    *beg = slots[0];
+    *end = slots[1];
+    return 1;
+}
@@ -56,7 +56,7 @@ ws (const char *pos, const char **fin) {
 }
 
 static int
-named_char_class (Parser *p, const char *pos, const char **fin, List **cc) {
+named_char_class (Parser *p, const char *pos, const char **fin, Vec *cc) {
     /* named_char_class: alnum | alpha | blank | cntrl | digit | graph |
                          lower | print | punct | space | upper | word |
                          xdigit  */
@@ -78,8 +78,8 @@ named_char_class (Parser *p, const char *pos, const char **fin, List **cc) {
     if (!retval)
         return 0;
     *fin = pos;
-    *cc = list_push(*cc, INT_TO_POINTER(CC_FUNC));
-    *cc = list_push(*cc, func);
+    vec_push(p->rx->arena, cc, INT_TO_POINTER(CC_FUNC));
+    vec_push(p->rx->arena, cc, func);
     return 1;
 }
 
@@ -112,10 +112,9 @@ escaped_char_class (Parser *p, const char *pos, const char **fin,
 }
 
 static int
-bracketed_char_class (Parser *p, const char *pos, const char **fin, List **cc) {
+bracketed_char_class (Parser *p, const char *pos, const char **fin, Vec *cc) {
     /* bracketed_char_class: '[' (<escaped_char_class> | <-[\]]>)* ']'  */
-    List *action = NULL;
-    int seen_char = 0;
+    int action = -1;
     int type;
     void *value;
     if (*pos++ != '[')
@@ -124,26 +123,34 @@ bracketed_char_class (Parser *p, const char *pos, const char **fin, List **cc) {
         ws(pos, &pos);
         if (!pos[0] || pos[0] == ']')
             break;
-        if (seen_char && !strncmp(pos, "..", 2)) {
+        if (action >= 0 && !strncmp(pos, "..", 2)) {
             pos += 2;
-            action->data = INT_TO_POINTER(CC_RANGE);
+            ws(pos, &pos);
+            cc->items[action] = INT_TO_POINTER(CC_RANGE);
+            action = -1;
+            if (!escaped_char_class(p, pos, &pos, &type, &value)) {
+                value = INT_TO_POINTER(pos[0]);
+                pos++;
+            }
+            else if (type != CC_CHAR) {
+                p->error = strdupf("expected char to end range at '%s'", pos);
+                return -1;
+            }
+            vec_push(p->rx->arena, cc, value);
             continue;
         }
-        if (!seen_char)
-            action = *cc = list_push(*cc, INT_TO_POINTER(CC_CHAR));
+        action = cc->n;
+        vec_push(p->rx->arena, cc, INT_TO_POINTER(CC_CHAR));
         if (escaped_char_class(p, pos, &pos, &type, &value)) {
-            action->data = INT_TO_POINTER(type);
-            *cc = list_push(*cc, value);
+            cc->items[action] = INT_TO_POINTER(type);
+            vec_push(p->rx->arena, cc, value);
+            if (type != CC_CHAR)
+                action = -1;
         }
         else {
-            *cc = list_push(*cc, INT_TO_POINTER(pos[0]));
+            vec_push(p->rx->arena, cc, INT_TO_POINTER(pos[0]));
             pos++;
         }
-        seen_char = 1;
-        if (action->data != INT_TO_POINTER(CC_CHAR)) {
-            action = NULL;
-            seen_char = 0;
-        }
     }
     if (*pos != ']') {
         p->error = strdupf("expected ']' at '%s'", pos);
@@ -154,9 +161,8 @@ bracketed_char_class (Parser *p, const char *pos, const char **fin, List **cc) {
 }
 
 static int
-char_class (Parser *p, const char *pos, const char **fin, List **cc) {
+char_class (Parser *p, const char *pos, const char **fin, Vec *cc) {
     /* char_class: <bracketed_char_class> | <named_char_class>  */
-    *cc = NULL;
     if (!bracketed_char_class(p, pos, &pos, cc) &&
         !named_char_class(p, pos, &pos, cc))
         return 0;
@@ -169,7 +175,6 @@ char_class (Parser *p, const char *pos, const char **fin, List **cc) {
 static int
 char_class_combo (Parser *p, const char *pos, const char **fin) {
     /* char_class_combo: <[+-]>? <char_class> (<[+-]> <char_class>)*  */
-    List *actions;
     CharClass *cc;
     int container = CC_INCLUDES;
     const char *start = pos;
@@ -178,32 +183,31 @@ char_class_combo (Parser *p, const char *pos, const char **fin) {
         pos++;
         ws(pos, &pos);
     }
-    if (!char_class(p, pos, fin, &actions))
+    cc = char_class_new(p->rx, start - 1, 0);
+    vec_push(p->rx->arena, &cc->actions, INT_TO_POINTER(container));
+    if (!char_class(p, pos, fin, &cc->actions))
         return 0;
     if (p->error)
         return -1;
     pos = *fin;
-    cc = char_class_new(p->rx, start - 1, 0);
-    cc->actions = list_push(cc->actions, INT_TO_POINTER(container));
-    cc->actions = list_cat(cc->actions, actions);
     p->rx->end = transition_state(p->rx->end, NULL, EAT|CHARCLASS, cc);
     while (1) {
         ws(pos, &pos);
         if (*pos != '+' && *pos != '-')
             break;
-        pos++;
         container = *pos == '-' ? CC_EXCLUDES : CC_INCLUDES;
+        pos++;
         ws(pos, &pos);
-        if (!char_class(p, pos, fin, &actions))
+        vec_push(p->rx->arena, &cc->actions, INT_TO_POINTER(container));
+        if (!char_class(p, pos, fin, &cc->actions))
             p->error = strdupf("expected charclass at '%s'", pos);
         if (p->error)
             return -1;
         pos = *fin;
-        cc->actions = list_cat(actions, cc->actions);
-        cc->actions = list_unshift(cc->actions, INT_TO_POINTER(container));
     }
     ws(pos, &pos);
     cc->length = pos - start + 2;
+    char_class_compile(cc);
     *fin = pos;
     return 1;
 }
@@ -246,10 +250,12 @@ group (Parser *p, const char *pos, const char **fin) {
         default: return 0;
     }
     group = rx_extend(orig);
-    if (ldelimeter == '(')
-        orig->captures = list_push(orig->captures, group);
+    if (ldelimeter == '(') {
+        vec_push(orig->arena, &orig->captures, group);
+        group->capture = orig->captures.n;
+    }
     else
-        orig->clusters = list_push(orig->clusters, group);
+        vec_push(orig->arena, &orig->clusters, group);
     p->rx = group;
     disjunction(p, pos, fin);
     p->rx = orig;
@@ -274,14 +280,15 @@ escape (Parser *p, const char *pos, const char **fin) {
         return 0;
     if (type == CC_FUNC || type == CC_NFUNC) {
         CharClass *cc = char_class_new(p->rx, pos - 2, 2);
-        cc->actions = list_push(cc->actions, INT_TO_POINTER(CC_INCLUDES));
-        cc->actions = list_push(cc->actions, INT_TO_POINTER(type));
-        cc->actions = list_push(cc->actions, value);
+        vec_push(p->rx->arena, &cc->actions, INT_TO_POINTER(CC_INCLUDES));
+        vec_push(p->rx->arena, &cc->actions, INT_TO_POINTER(type));
+        vec_push(p->rx->arena, &cc->actions, value);
+        char_class_compile(cc);
         p->rx->end = transition_state(p->rx->end, NULL, EAT|CHARCLASS, cc);
     }
     else {
         p->rx->end = transition_state(
-            p->rx->end, NULL, CC_CHAR ? EAT|CHAR : EAT|NEGCHAR, value);
+            p->rx->end, NULL, type == CC_CHAR ? EAT|CHAR : EAT|NEGCHAR, value);
     }
     return 1;
 }
@@ -327,8 +334,8 @@ character (Parser *p, const char *pos, const char **fin) {
 
 static int
 quantifier (Parser *p, const char *pos, const char **fin, State **start) {
-    /* quantifier: '**' \d+ ('..' (\d+ | '*'))? | '*' | '+' | '?'  */
-    int min = 1, max = 1;
+    /* quantifier: ('**' \d+ ('..' (\d+ | '*'))? | '*' | '+' | '?') '?'?  */
+    int min = 1, max = 1, frugal = 0;
     if (!strncmp(pos, "**", 2)) {
         pos += 2;
         ws(pos, &pos);
@@ -383,48 +390,57 @@ quantifier (Parser *p, const char *pos, const char **fin, State **start) {
     else {
         return 0;
     }
+    if (*pos == '?') {
+        frugal = 1;
+        pos++;
+    }
     *fin = pos;
-    quantify(start, &p->rx->end, min, max);
+    quantify(start, &p->rx->end, min, max, frugal);
     return 1;
 }
 
 static int
 assertion (Parser *p, const char *pos, const char **fin) {
     /* assertion: '^' | '^^' | '$' | '$$' | '<<' | '>>' | '\b' | '\B'  */
+    int (*func) () = NULL;
     if (pos[0] == '^' && pos[1] == '^') {
-        p->rx->end->assertfunc = bol;
+        func = bol;
         pos += 2;
     }
     else if (pos[0] == '^') {
-        p->rx->end->assertfunc = bos;
+        func = bos;
         pos++;
     }
     else if (pos[0] == '$' && pos[1] == '$') {
-        p->rx->end->assertfunc = eol;
+        func = eol;
         pos += 2;
     }
     else if (pos[0] == '$') {
-        p->rx->end->assertfunc = eos;
+        func = eos;
         pos++;
     }
     else if (pos[0] == '<' && pos[1] == '<') {
-        p->rx->end->assertfunc = lwb;
+        func = lwb;
         pos += 2;
     }
     else if (pos[0] == '>' && pos[1] == '>') {
-        p->rx->end->assertfunc = rwb;
+        func = rwb;
         pos += 2;
     }
     else if (pos[0] == '\\' && pos[1] == 'b') {
-        p->rx->end->assertfunc = wb;
+        func = wb;
         pos += 2;
     }
     else if (pos[0] == '\\' && pos[1] == 'B') {
-        p->rx->end->assertfunc = nwb;
+        func = nwb;
         pos += 2;
     }
     else
         return 0;
+    /* Each assertion gets a state of its own, so that one in a later
+    alternative doesn't land on the state all the alternatives share.  */
+    p->rx->end = transition_state(p->rx->end, NULL, 0, NULL);
+    p->rx->end->assertfunc = func;
     *fin = pos;
     return 1;
 }
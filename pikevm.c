@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+A Pike VM runs every thread of the program in lock step over the
+string, so no position is looked at more than once per instruction and
+the time taken is proportional to the size of the program times the
+length of the string.
+
+What used to make this hard was greedy vs frugal: which of several
+matches is the right one. The threads here are kept in priority order,
+the order the backtracker in matcher.c would have tried them in. When
+a thread matches, every thread behind it is dropped, since the
+backtracker would never have gotten to them, while the threads ahead
+of it keep running and replace the match if they match later on. The
+match left when all threads die is the one the backtracker finds.
+
+Each thread list holds threads sitting at an instruction that eats a
+char. The forks, jumps and assertions in front of them are followed
+when the list is built, at which point the char at that position is
+known, so assertions can look at it.
+
+Since the VM never looks back at the string, it can be fed the string
+a piece at a time. All it keeps between pieces is its threads, the
+PrevFlags of the last char it read and how far into the string it is,
+and threads remember where they began as an offset from the start of
+the whole string rather than as a pointer into one of the pieces.
+
+Each thread also carries the slots an OP_SAVE stores the offsets of
+groups in, with the first two for where its match began and ended. The
+slots being worked on while the threads are followed from one place are
+kept in the VM, and the stack that follows them puts back what an
+OP_SAVE overwrote before going on to the next alternative of a fork.
+
+Calls into <~~N> subroutines are atomic and need a stack, which a set
+of threads can't have, so programs with OP_CALL are left to the
+backtracker.
+*/
+
+#define SLOT_NONE ((size_t) -1)
+
+/* An instruction to follow, or if slot isn't -1, a slot to put value
+back in. fresh is the outermost loop whose current time round began at
+this place, or -1.  */
+typedef struct {
+    unsigned int pc;
+    int          fresh;
+    int          slot;
+    size_t       value;
+} Frame;
+
+typedef struct {
+    unsigned int *pcs;
+    size_t       *slots;
+    int           n;
+} ThreadList;
+
+struct Pike {
+    Prog         *prog;
+    unsigned int *sparse;
+    unsigned int *dense;
+    int           nvisited;
+    Frame        *stack;
+    ThreadList    clist;
+    ThreadList    nlist;
+    int           maxinsts;
+    size_t        maxkeys;
+    int           maxslots;
+    int           nslots;
+    size_t       *slots;
+    size_t       *matchslots;
+    size_t        offset;
+    int           prev;
+    int           matched;
+    int           done;
+};
+
+/* Whether loop is outer or lies somewhere in its body.  */
+static int
+encloses (Prog *prog, int outer, int loop) {
+    if (outer < 0 || loop < 0)
+        return 0;
+    while (prog->loops[loop].depth > prog->loops[outer].depth)
+        loop = prog->loops[loop].outer;
+    return loop == outer;
+}
+
+/* Threads at the same instruction only differ by the loops that went
+round again at this place, and those are the ones from fresh inwards,
+so an instruction is visited once for each depth fresh can be at.  */
+static int
+visit (Pike *vm, unsigned int pc, int fresh) {
+    Prog *prog = vm->prog;
+    unsigned int key = pc, i;
+    if (fresh >= 0)
+        key += prog->ninsts * prog->loops[fresh].depth;
+    i = vm->sparse[key];
+    if (i < vm->nvisited && vm->dense[i] == key)
+        return 0;
+    vm->sparse[key] = vm->nvisited;
+    vm->dense[vm->nvisited++] = key;
+    return 1;
+}
+
+static void
+push (Pike *vm, int *top, unsigned int pc, int fresh, int slot,
+      size_t value) {
+    Frame *frame = &vm->stack[(*top)++];
+    frame->pc = pc;
+    frame->fresh = fresh;
+    frame->slot = slot;
+    frame->value = value;
+}
+
+static int
+consumes (Inst *inst) {
+    return inst->op == OP_CHAR || inst->op == OP_ANY ||
+           inst->op == OP_NCHAR || inst->op == OP_CLASS;
+}
+
+/* Follows everything that doesn't eat a char from pc with the slots in
+vm->slots, knowing that the next char is c, or -1 at the end, and adds
+the threads it reaches to the list in priority order. Returns 0 once a
+thread matches, since nothing after it matters anymore.
+
+Like the backtracker, an OP_PROGRESS fails when its loop went round
+without eating anything. Once a thread eats a char every loop it's in
+has made progress, so only the loops it went into at this place need
+to be kept track of, and of those, only the outermost one it's still
+in: the loops in that one's body began at this place too.  */
+static int
+add_thread (Pike *vm, ThreadList *list, unsigned int pc, int c) {
+    Prog *prog = vm->prog;
+    size_t slotsize = vm->nslots * sizeof (size_t);
+    Frame *frame;
+    Inst *inst;
+    unsigned int i;
+    int top = 0, fresh;
+    push(vm, &top, pc, -1, -1, 0);
+    while (top) {
+        frame = &vm->stack[--top];
+        if (frame->slot >= 0) {
+            vm->slots[frame->slot] = frame->value;
+            continue;
+        }
+        pc = frame->pc;
+        inst = &prog->insts[pc];
+        fresh = frame->fresh;
+        if (consumes(inst) || !encloses(prog, fresh, prog->inloop[pc]))
+            fresh = -1;
+        if (!visit(vm, pc, fresh))
+            continue;
+        switch (inst->op) {
+            case OP_MATCH:
+                memcpy(vm->matchslots, vm->slots, slotsize);
+                vm->matchslots[1] = vm->offset;
+                vm->matched = 1;
+                return 0;
+            case OP_FORK:
+                for (i = inst->arg; i > 0; i--)
+                    push(vm, &top, pc + i, fresh, -1, 0);
+                break;
+            case OP_LOOP:
+                if (!encloses(prog, fresh, inst->arg))
+                    fresh = inst->arg;
+                push(vm, &top, inst->out, fresh, -1, 0);
+                break;
+            case OP_PROGRESS:
+                if (!encloses(prog, fresh, inst->arg))
+                    push(vm, &top, inst->out, fresh, -1, 0);
+                break;
+            case OP_JMP:
+                push(vm, &top, inst->out, fresh, -1, 0);
+                break;
+            case OP_SAVE:
+                push(vm, &top, 0, -1, inst->arg + 2,
+                     vm->slots[inst->arg + 2]);
+                vm->slots[inst->arg + 2] = vm->offset;
+                push(vm, &top, inst->out, fresh, -1, 0);
+                break;
+            case OP_ASSERT:
+                if (assert_context(inst->arg, vm->prev, c))
+                    push(vm, &top, inst->out, fresh, -1, 0);
+                break;
+            case OP_CHAR:
+            case OP_ANY:
+            case OP_NCHAR:
+            case OP_CLASS:
+                list->pcs[list->n] = pc;
+                memcpy(list->slots + list->n * vm->nslots, vm->slots,
+                       slotsize);
+                list->n++;
+                break;
+        }
+    }
+    return 1;
+}
+
+/* Moves the threads that ate the last char on to the place after it,
+knowing the next char is c, and starts a new thread there unless a match
+was already found. Returns 0 if that settles the match: a match was
+found and no thread ahead of it is left, or the program is anchored and
+no thread is left at all.  */
+static int
+add_threads (Pike *vm, int c) {
+    ThreadList *clist = &vm->clist, *nlist = &vm->nlist;
+    int i;
+    vm->nvisited = 0;
+    nlist->n = 0;
+    for (i = 0; i < clist->n; i++) {
+        memcpy(vm->slots, clist->slots + i * vm->nslots,
+               vm->nslots * sizeof (size_t));
+        if (!add_thread(vm, nlist, vm->prog->insts[clist->pcs[i]].out, c))
+            break;
+    }
+    if (i == clist->n && !vm->matched) {
+        for (i = 0; i < vm->nslots; i++)
+            vm->slots[i] = SLOT_NONE;
+        vm->slots[0] = vm->offset;
+        add_thread(vm, nlist, vm->prog->start, c);
+    }
+    return nlist->n || !vm->matched && !vm->prog->anchored;
+}
+
+static int
+step (Prog *prog, unsigned int pc, int c) {
+    Inst *inst = &prog->insts[pc];
+    switch (inst->op) {
+        case OP_CHAR:  return c == inst->arg;
+        case OP_ANY:   return 1;
+        case OP_NCHAR: return c != inst->arg;
+        case OP_CLASS: return char_class_match(prog->classes[inst->arg], c);
+    }
+    return 0;
+}
+
+/* Every instruction is followed at most once per place for each depth
+of fresh loop, and an OP_FORK pushes as many frames as it has
+alternatives and an OP_SAVE two, so the stack never holds more than two
+frames per visit.  */
+static Pike *
+pike_alloc (size_t n, size_t nkeys, size_t nslots) {
+    Pike *vm = calloc(1, sizeof (Pike));
+    vm->maxinsts = n;
+    vm->maxkeys = nkeys;
+    vm->maxslots = nslots;
+    vm->sparse = malloc(nkeys * sizeof (unsigned int));
+    vm->dense = malloc(nkeys * sizeof (unsigned int));
+    vm->stack = malloc((2 * nkeys + 1) * sizeof (Frame));
+    vm->clist.pcs = malloc(n * sizeof (unsigned int));
+    vm->nlist.pcs = malloc(n * sizeof (unsigned int));
+    vm->clist.slots = malloc(n * nslots * sizeof (size_t));
+    vm->nlist.slots = malloc(n * nslots * sizeof (size_t));
+    vm->slots = malloc(nslots * sizeof (size_t));
+    vm->matchslots = malloc(nslots * sizeof (size_t));
+    return vm;
+}
+
+static size_t
+pike_keys (Prog *prog) {
+    return (size_t) prog->ninsts * (prog->loopdepth + 1);
+}
+
+/* Returns how many bytes a VM to run prog takes.  */
+size_t
+pike_size (Prog *prog) {
+    size_t n = prog->ninsts, nkeys = pike_keys(prog);
+    size_t nslots = 2 + 2 * prog->ncaptures;
+    return sizeof (Pike) + 2 * nkeys * sizeof (unsigned int) +
+           (2 * nkeys + 1) * sizeof (Frame) +
+           2 * n * (sizeof (unsigned int) + nslots * sizeof (size_t)) +
+           2 * nslots * sizeof (size_t);
+}
+
+Pike *
+pike_new (Prog *prog) {
+    Pike *vm = pike_alloc(prog->ninsts, pike_keys(prog),
+                          2 + 2 * prog->ncaptures);
+    pike_reset(vm, prog);
+    return vm;
+}
+
+/* Returns a VM big enough to run prog as well as everything vm could,
+which is vm itself if it already is. The VM has to be reset to run
+prog before it's fed.  */
+Pike *
+pike_grow (Pike *vm, Prog *prog) {
+    int ninsts = prog->ninsts, nslots = 2 + 2 * prog->ncaptures;
+    size_t nkeys = pike_keys(prog);
+    if (vm && ninsts <= vm->maxinsts && nkeys <= vm->maxkeys &&
+        nslots <= vm->maxslots)
+        return vm;
+    if (vm) {
+        if (ninsts < vm->maxinsts)
+            ninsts = vm->maxinsts;
+        if (nkeys < vm->maxkeys)
+            nkeys = vm->maxkeys;
+        if (nslots < vm->maxslots)
+            nslots = vm->maxslots;
+        pike_free(vm);
+    }
+    return pike_alloc(ninsts, nkeys, nslots);
+}
+
+void
+pike_free (Pike *vm) {
+    if (!vm)
+        return;
+    free(vm->sparse);
+    free(vm->dense);
+    free(vm->stack);
+    free(vm->clist.pcs);
+    free(vm->nlist.pcs);
+    free(vm->clist.slots);
+    free(vm->nlist.slots);
+    free(vm->slots);
+    free(vm->matchslots);
+    free(vm);
+}
+
+/* Gets the VM ready to be fed another string from the start, to match
+prog, which it has to be big enough for.  */
+void
+pike_reset (Pike *vm, Prog *prog) {
+    vm->prog = prog;
+    vm->nslots = 2 + 2 * prog->ncaptures;
+    vm->clist.n = vm->nlist.n = 0;
+    vm->offset = 0;
+    vm->prev = PREV_BOS;
+    vm->matched = 0;
+    vm->done = 0;
+}
+
+/* Runs the VM over the next len bytes of the string. Returns 1 once the
+match is settled, after which there's no need to feed it any more.  */
+int
+pike_feed (Pike *vm, const char *buf, size_t len) {
+    Prog *prog = vm->prog;
+    const char *pos = buf, *end = buf + len, *found;
+    unsigned char c;
+    int i;
+    while (pos < end && !vm->done) {
+        /* clist holds the threads that ate the previous char, still
+        sitting on the instruction that ate it.  */
+        if (!vm->clist.n && !vm->matched && prog->skip) {
+            /* A prefix that isn't in this piece could still begin in
+            its last few bytes and go on into the next.  */
+            if (!(found = prog_find_start(prog, pos, end))) {
+                found = end;
+                if (prog->nprefix > 1)
+                    found -= end - pos < prog->nprefix ?
+                             end - pos : prog->nprefix - 1;
+            }
+            if (found > pos) {
+                vm->offset += found - pos;
+                vm->prev = prev_flags((unsigned char) found[-1]);
+                pos = found;
+            }
+            if (pos == end)
+                break;
+        }
+        c = *pos;
+        if (!add_threads(vm, c)) {
+            vm->done = 1;
+            break;
+        }
+        vm->clist.n = 0;
+        for (i = 0; i < vm->nlist.n; i++) {
+            if (!step(prog, vm->nlist.pcs[i], c))
+                continue;
+            vm->clist.pcs[vm->clist.n] = vm->nlist.pcs[i];
+            memcpy(vm->clist.slots + vm->clist.n * vm->nslots,
+                   vm->nlist.slots + i * vm->nslots,
+                   vm->nslots * sizeof (size_t));
+            vm->clist.n++;
+        }
+        vm->prev = prev_flags(c);
+        vm->offset++;
+        pos++;
+    }
+    return vm->done;
+}
+
+/* Tells the VM the string has ended. Returns whether it matched, and if
+so, the offsets of where the match begins and ends.  */
+int
+pike_finish (Pike *vm, size_t *beg, size_t *end) {
+    if (!vm->done)
+        add_threads(vm, -1);
+    vm->done = 1;
+    if (vm->matched) {
+        *beg = vm->matchslots[0];
+        *end = vm->matchslots[1];
+    }
+    return vm->matched;
+}
+
+/* The slots of the match once the VM is finished: where it begins and
+ends, then where each group saved by OP_SAVE begins and ends, or -1 for
+the ones the match didn't go through.  */
+const size_t *
+pike_slots (Pike *vm) {
+    return vm->matchslots;
+}
+
+int
+pike_match (Prog *prog, const char *str, size_t len, const char **beg,
+            const char **end) {
+    Pike *vm = pike_new(prog);
+    size_t b, e;
+    int retval;
+    pike_feed(vm, str, len);
+    retval = pike_finish(vm, &b, &e);
+    pike_free(vm);
+    if (retval) {
+        *beg = str + b;
+        *end = str + e;
+    }
+    return retval;
+}
@@ -0,0 +1,1077 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "rxpriv.h"
+
+/*
+The parser builds a graph of State objects, each with a Vec of
+separately allocated Transitions, and groups that live in their own
+nested Rx. Walking that graph at match time means chasing several
+pointers per character. This file lowers the graph into a Prog, a
+single array of fixed size instructions that refer to each other by
+index.
+
+A state with one transition becomes one instruction. A state with
+several transitions becomes an OP_FORK followed directly by one
+instruction per transition, in priority order. An assertion on a state
+becomes an OP_ASSERT in front of it. Groups are inlined, so the last
+state of a group simply jumps to whatever follows the group.
+Quantifiers are unrolled: the body is copied min times, followed
+either by a loop for an open range or by max - min optional copies.
+Loops are bracketed by OP_LOOP and OP_PROGRESS so that a body that can
+match the empty string does not spin forever. The Pike VM has to know
+which loops a thread is still in to do the same, so prog->inloop has
+the innermost loop each instruction lies in, and prog->loops the loop
+each loop lies in. When unrolling would make for more than UNROLL_BUDGET
+instructions all told, the largest bounds are counted instead: OP_COUNT
+starts a counter at zero and OP_REPEAT goes round the body once more or
+leaves, as far as the counter and the bounds kept in a Counter allow.
+The automata would have to tell every count apart, so programs that
+count are left to the backtracker.
+
+A capture reference <~~N> (or <~~> for the whole regex) becomes an
+OP_CALL into a separately compiled copy of that group which ends with
+OP_RET. The call is atomic: it returns the first way the group can
+match and is never backtracked into.
+
+When every match has to begin with the same few chars, they are kept
+as the prefix of the program, and the engines use memchr() or memmem()
+to skip ahead to the next place they occur instead of trying every
+position in between. Failing that, if the first char of every match is
+in some set short of everything, they skip ahead to the next char in
+that set with byte_set_find(). Chars that every match has to contain somewhere
+else are kept as factors, and rx_match() rejects a string that lacks
+one of them without running an engine at all. Those are found as the
+OP_CHARs that dominate OP_MATCH: the ones every path from the start to
+a match goes through.
+*/
+
+/* How many instructions quantifiers may be unrolled into, and past that,
+the bounds above which they are counted on each attempt to fit.  */
+#define UNROLL_BUDGET 65536
+
+static const unsigned int unroll_max[] = {UINT_MAX, 64, 8, 1};
+
+#define DOMINATORS_MAX_STEPS (1L << 24)
+
+typedef enum {
+    SCOPE_TOP, SCOPE_SUB, SCOPE_GROUP
+} ScopeKind;
+
+typedef struct Scope Scope;
+struct Scope {
+    ScopeKind     kind;
+    unsigned int  cont;
+    int           loop;
+    State       **keys;
+    unsigned int *pcs;
+    int           nkeys;
+    int           size;
+    Scope        *next;
+};
+
+typedef struct {
+    State        *state;
+    Scope        *scope;
+    unsigned int  pc;
+} Pending;
+
+typedef struct {
+    Prog         *prog;
+    Rx           *root;
+    int           capinsts;
+    Pending      *work;
+    int           nwork;
+    int           capwork;
+    Scope        *scopes;
+    unsigned int *subs;
+    int           nsubs;
+    unsigned int  unroll;
+    unsigned int  budget;
+    int           over;
+} Compiler;
+
+static unsigned int quantified ();
+
+static Scope *
+scope_new (Compiler *c, ScopeKind kind, unsigned int cont, int loop) {
+    Scope *scope = calloc(1, sizeof (Scope));
+    scope->kind = kind;
+    scope->cont = cont;
+    scope->loop = loop;
+    scope->next = c->scopes;
+    c->scopes = scope;
+    return scope;
+}
+
+static void
+scope_free (Scope *scope) {
+    free(scope->keys);
+    free(scope->pcs);
+    free(scope);
+}
+
+static int
+scope_index (Scope *scope, State *state) {
+    int index = ((unsigned long) state >> 4) % scope->size;
+    while (scope->keys[index] && scope->keys[index] != state)
+        index = (index + 1) % scope->size;
+    return index;
+}
+
+static void
+scope_insert (Scope *scope, State *state, unsigned int pc) {
+    int i, index, size;
+    State **keys;
+    unsigned int *pcs;
+    if (2 * (scope->nkeys + 1) > scope->size) {
+        keys = scope->keys;
+        pcs = scope->pcs;
+        size = scope->size;
+        scope->size = size ? 2 * size : 16;
+        scope->keys = calloc(scope->size, sizeof (State *));
+        scope->pcs = calloc(scope->size, sizeof (unsigned int));
+        for (i = 0; i < size; i++) {
+            if (!keys[i])
+                continue;
+            index = scope_index(scope, keys[i]);
+            scope->keys[index] = keys[i];
+            scope->pcs[index] = pcs[i];
+        }
+        free(keys);
+        free(pcs);
+    }
+    index = scope_index(scope, state);
+    scope->keys[index] = state;
+    scope->pcs[index] = pc;
+    scope->nkeys++;
+}
+
+/* Reserves n instructions that lie in the body of the given loop.  */
+static unsigned int
+reserve (Compiler *c, int n, int loop) {
+    Prog *prog = c->prog;
+    unsigned int pc = prog->ninsts;
+    int i;
+    if (prog->ninsts + n > c->capinsts) {
+        while (prog->ninsts + n > c->capinsts)
+            c->capinsts = c->capinsts ? 2 * c->capinsts : 64;
+        prog->insts = realloc(prog->insts, c->capinsts * sizeof (Inst));
+        prog->inloop = realloc(prog->inloop, c->capinsts * sizeof (int));
+    }
+    memset(prog->insts + pc, 0, n * sizeof (Inst));
+    for (i = 0; i < n; i++)
+        prog->inloop[pc + i] = loop;
+    prog->ninsts += n;
+    if (c->budget && prog->ninsts > c->budget)
+        c->over = 1;
+    return pc;
+}
+
+static int
+state_size (State *state) {
+    int n = state->transitions.n;
+    return (state->assertfunc ? 1 : 0) + (n > 1 ? n + 1 : 1);
+}
+
+/* Returns where the state starts in the given scope, reserving room for
+it and queueing it to be filled in if it hasn't been seen yet.  */
+static unsigned int
+ref (Compiler *c, Scope *scope, State *state) {
+    unsigned int pc;
+    if (scope->size) {
+        int index = scope_index(scope, state);
+        if (scope->keys[index])
+            return scope->pcs[index];
+    }
+    pc = reserve(c, state_size(state), scope->loop);
+    scope_insert(scope, state, pc);
+    if (c->nwork == c->capwork) {
+        c->capwork = c->capwork ? 2 * c->capwork : 64;
+        c->work = realloc(c->work, c->capwork * sizeof (Pending));
+    }
+    c->work[c->nwork].state = state;
+    c->work[c->nwork].scope = scope;
+    c->work[c->nwork].pc = pc;
+    c->nwork++;
+    return pc;
+}
+
+static Inst *
+emit (Compiler *c, unsigned int pc, int op, unsigned int out,
+      unsigned int arg) {
+    Inst *inst = &c->prog->insts[pc];
+    inst->op = op;
+    inst->out = out;
+    inst->arg = arg;
+    return inst;
+}
+
+static int
+assert_kind (int (*func) ()) {
+    int i;
+    for (i = 0; i < ASSERT_MAX; i++) {
+        if (assertions[i] == func)
+            return i;
+    }
+    return -1;
+}
+
+/* Returns the entry of a subroutine matching capture n, or the whole
+regex when n is negative, compiling it the first time it's needed.  */
+static unsigned int
+subroutine (Compiler *c, int n) {
+    Rx *group;
+    Scope *scope;
+    int index = n < 0 ? c->nsubs - 1 : n;
+    if (c->subs[index] != INST_NONE)
+        return c->subs[index];
+    group = n < 0 ? c->root : n < c->root->captures.n ?
+            c->root->captures.items[n] : NULL;
+    scope = scope_new(c, SCOPE_SUB, 0, -1);
+    c->subs[index] = ref(c, scope, group->start);
+    c->prog->ncalls++;
+    return c->subs[index];
+}
+
+static void
+transition (Compiler *c, Scope *scope, Transition *t, unsigned int pc) {
+    int capture;
+    if (t->type & QUANTIFIED) {
+        emit(c, pc, OP_JMP, quantified(c, scope, t), 0);
+    }
+    else if (t->type & CAPTUREREF) {
+        capture = POINTER_TO_INT(t->param);
+        if (capture >= c->nsubs - 1)
+            emit(c, pc, OP_FAIL, 0, 0);
+        else
+            emit(c, pc, OP_CALL, ref(c, scope, t->ret), subroutine(c, capture));
+    }
+    else if (t->ret) {
+        unsigned int cont = ref(c, scope, t->ret), close;
+        Rx *rx = t->to->group;
+        Scope *group;
+        /* A capture of the regex itself, rather than of a group in it,
+        saves where it begins and ends.  */
+        capture = rx->capture && rx->extends.items[0] == c->root ?
+                  rx->capture - 1 : -1;
+        if (capture >= 0) {
+            close = reserve(c, 1, scope->loop);
+            emit(c, close, OP_SAVE, cont, 2 * capture + 1);
+            cont = close;
+        }
+        group = scope_new(c, SCOPE_GROUP, cont, scope->loop);
+        if (capture >= 0)
+            emit(c, pc, OP_SAVE, ref(c, group, t->to), 2 * capture);
+        else
+            emit(c, pc, OP_JMP, ref(c, group, t->to), 0);
+    }
+    else if (t->type & CHAR) {
+        emit(c, pc, OP_CHAR, ref(c, scope, t->to),
+             (unsigned char) POINTER_TO_INT(t->param));
+    }
+    else if (t->type & NEGCHAR) {
+        emit(c, pc, OP_NCHAR, ref(c, scope, t->to),
+             (unsigned char) POINTER_TO_INT(t->param));
+    }
+    else if (t->type & ANYCHAR) {
+        emit(c, pc, OP_ANY, ref(c, scope, t->to), 0);
+    }
+    else if (t->type & CHARCLASS) {
+        Prog *prog = c->prog;
+        prog->classes = realloc(
+            prog->classes, (prog->nclasses + 1) * sizeof (CharClass *));
+        prog->classes[prog->nclasses] = t->param;
+        emit(c, pc, OP_CLASS, ref(c, scope, t->to), prog->nclasses++);
+    }
+    else {
+        emit(c, pc, OP_JMP, ref(c, scope, t->to), 0);
+    }
+}
+
+/* Compiles a loop around the body of the quantified atom that goes round
+between min and max times, counting as it goes, and then carries on at
+tail.  */
+static unsigned int
+counted (Compiler *c, Scope *scope, Transition *t, unsigned int min,
+         unsigned int max, unsigned int tail) {
+    Quantified *q = t->param;
+    Prog *prog = c->prog;
+    unsigned int pc = reserve(c, 3, scope->loop);
+    Scope *body = scope_new(c, SCOPE_GROUP, pc + 1, scope->loop);
+    Counter *counter;
+    prog->counters = realloc(prog->counters,
+                             (prog->ncounters + 1) * sizeof (Counter));
+    counter = &prog->counters[prog->ncounters];
+    counter->min = min;
+    counter->max = max;
+    counter->frugal = q->frugal;
+    emit(c, pc, OP_COUNT, pc + 1, prog->ncounters);
+    emit(c, pc + 1, OP_REPEAT, tail, prog->ncounters++);
+    emit(c, pc + 2, OP_JMP, ref(c, body, t->to), 0);
+    return pc;
+}
+
+/* Unrolls a quantified atom into copies of its body. The chain is built
+back to front so each copy knows where to continue. A frugal quantifier
+just tries leaving before trying another copy. Bounds over c->unroll
+are counted instead.  */
+static unsigned int
+quantified (Compiler *c, Scope *scope, Transition *t) {
+    Quantified *q = t->param;
+    unsigned int exit = ref(c, scope, t->ret);
+    unsigned int tail = exit;
+    unsigned int pc, loop;
+    Prog *prog = c->prog;
+    Scope *body;
+    int i;
+    if (!q->max) {
+        pc = reserve(c, 5, scope->loop);
+        loop = prog->nloops++;
+        prog->loops = realloc(prog->loops, prog->nloops * sizeof (Loop));
+        prog->loops[loop].outer = scope->loop;
+        prog->loops[loop].depth = scope->loop < 0 ? 1 :
+                                  prog->loops[scope->loop].depth + 1;
+        for (i = 1; i < 5; i++)
+            prog->inloop[pc + i] = loop;
+        body = scope_new(c, SCOPE_GROUP, pc + 4, loop);
+        emit(c, pc, OP_LOOP, pc + 1, loop);
+        emit(c, pc + 1, OP_FORK, 0, 2);
+        emit(c, pc + 2 + q->frugal, OP_JMP, ref(c, body, t->to), 0);
+        emit(c, pc + 3 - q->frugal, OP_JMP, tail, 0);
+        emit(c, pc + 4, OP_PROGRESS, pc, loop);
+        tail = pc;
+    }
+    else if (q->max > c->unroll) {
+        return counted(c, scope, t, q->min, q->max, exit);
+    }
+    else {
+        for (i = q->max - q->min; i > 0 && !c->over; i--) {
+            pc = reserve(c, 3, scope->loop);
+            body = scope_new(c, SCOPE_GROUP, tail, scope->loop);
+            emit(c, pc, OP_FORK, 0, 2);
+            emit(c, pc + 1 + q->frugal, OP_JMP, ref(c, body, t->to), 0);
+            emit(c, pc + 2 - q->frugal, OP_JMP, exit, 0);
+            tail = pc;
+        }
+    }
+    if (q->min > c->unroll)
+        return counted(c, scope, t, q->min, q->min, tail);
+    for (i = 0; i < q->min && !c->over; i++) {
+        body = scope_new(c, SCOPE_GROUP, tail, scope->loop);
+        tail = ref(c, body, t->to);
+    }
+    return tail;
+}
+
+static void
+fill (Compiler *c, Pending *p) {
+    State *state = p->state;
+    unsigned int pc = p->pc;
+    int n, i;
+    if (state->assertfunc) {
+        emit(c, pc, OP_ASSERT, pc + 1, assert_kind(state->assertfunc));
+        pc++;
+    }
+    n = state->transitions.n;
+    if (!n) {
+        switch (p->scope->kind) {
+            case SCOPE_TOP: emit(c, pc, OP_MATCH, 0, 0); break;
+            case SCOPE_SUB: emit(c, pc, OP_RET, 0, 0); break;
+            default: emit(c, pc, OP_JMP, p->scope->cont, 0); break;
+        }
+        return;
+    }
+    if (n > 1)
+        emit(c, pc++, OP_FORK, 0, n);
+    for (i = 0; i < n; i++)
+        transition(c, p->scope, state->transitions.items[i], pc++);
+}
+
+/* Follows chains of jumps so that nothing points at a lone OP_JMP.  */
+static unsigned int
+follow (Prog *prog, unsigned int pc) {
+    int hops = 0;
+    while (prog->insts[pc].op == OP_JMP && hops++ < prog->ninsts)
+        pc = prog->insts[pc].out;
+    return pc;
+}
+
+static int
+has_out (Inst *inst) {
+    return inst->op != OP_FORK && inst->op != OP_MATCH &&
+           inst->op != OP_RET && inst->op != OP_FAIL;
+}
+
+static int
+block_size (Inst *inst) {
+    return inst->op == OP_FORK ? inst->arg + 1 : inst->op == OP_REPEAT ? 2 : 1;
+}
+
+/* How many places an instruction can go on to, and where the i-th of
+them is.  */
+static int
+nsuccs (Inst *inst) {
+    return inst->op == OP_FORK ? inst->arg :
+           inst->op == OP_REPEAT ? 2 : has_out(inst);
+}
+
+static unsigned int
+succ (Prog *prog, unsigned int pc, int i) {
+    Inst *inst = &prog->insts[pc];
+    return inst->op == OP_FORK ? pc + 1 + i : i ? pc + 1 : inst->out;
+}
+
+/* Whether an instruction eats a char.  */
+static int
+consumes (Inst *inst) {
+    return inst->op == OP_CHAR || inst->op == OP_ANY ||
+           inst->op == OP_NCHAR || inst->op == OP_CLASS;
+}
+
+/* A loop whose body is one instruction that eats a char can't go round
+without making progress, so it doesn't need OP_LOOP and OP_PROGRESS,
+and the body can go straight back to the fork. That leaves the run
+loops the backtracker looks for.  */
+static void
+unguard_loops (Prog *prog) {
+    unsigned int pc, i, fork, body, progress;
+    Inst *loop;
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        loop = &prog->insts[pc];
+        if (loop->op != OP_LOOP)
+            continue;
+        fork = follow(prog, loop->out);
+        if (prog->insts[fork].op != OP_FORK)
+            continue;
+        for (i = 1; i <= prog->insts[fork].arg; i++) {
+            body = fork + i;
+            if (prog->insts[body].op == OP_JMP)
+                body = follow(prog, prog->insts[body].out);
+            if (!consumes(&prog->insts[body]))
+                continue;
+            progress = follow(prog, prog->insts[body].out);
+            if (prog->insts[progress].op != OP_PROGRESS ||
+                prog->insts[progress].arg != loop->arg ||
+                follow(prog, prog->insts[progress].out) != pc)
+                continue;
+            prog->insts[body].out = fork;
+            loop->op = OP_JMP;
+            loop->out = fork;
+            break;
+        }
+    }
+}
+
+/* Threads jumps and lays the reachable instructions out again in the
+order they are reached from the start, so that a match walks forward
+through the array as much as possible.  */
+static void
+compact (Prog *prog, unsigned int *subs, int nsubs) {
+    unsigned int *map, *queue;
+    unsigned int pc, i;
+    int head = 0, tail = 0, ninsts = 0, n, *inloop;
+    Inst *insts, *inst;
+    unguard_loops(prog);
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        inst = &prog->insts[pc];
+        if (has_out(inst))
+            inst->out = follow(prog, inst->out);
+        if (inst->op == OP_CALL)
+            inst->arg = follow(prog, inst->arg);
+    }
+    /* A fork alternative or a counted loop body that only jumps to a
+    single instruction can be that instruction.  */
+    for (pc = 0; pc < prog->ninsts; pc += block_size(inst)) {
+        inst = &prog->insts[pc];
+        for (i = 1; i < block_size(inst); i++) {
+            Inst *alt = inst + i;
+            if (alt->op == OP_JMP && block_size(&prog->insts[alt->out]) == 1)
+                *alt = prog->insts[alt->out];
+        }
+    }
+    prog->start = follow(prog, prog->start);
+    for (i = 0; i < nsubs; i++) {
+        if (subs[i] != INST_NONE)
+            subs[i] = follow(prog, subs[i]);
+    }
+    map = malloc(prog->ninsts * sizeof (unsigned int));
+    queue = malloc(prog->ninsts * sizeof (unsigned int));
+    for (pc = 0; pc < prog->ninsts; pc++)
+        map[pc] = INST_NONE;
+    map[prog->start] = 0;
+    queue[tail++] = prog->start;
+    ninsts = block_size(&prog->insts[prog->start]);
+    while (head < tail) {
+        unsigned int targets[2];
+        int k, ntargets;
+        pc = queue[head++];
+        inst = &prog->insts[pc];
+        n = inst->op == OP_FORK ? inst->arg : block_size(inst);
+        if (inst->op == OP_FORK)
+            inst++;
+        for (; n--; inst++) {
+            ntargets = 0;
+            if (has_out(inst))
+                targets[ntargets++] = inst->out;
+            if (inst->op == OP_CALL)
+                targets[ntargets++] = inst->arg;
+            for (k = 0; k < ntargets; k++) {
+                if (map[targets[k]] != INST_NONE)
+                    continue;
+                map[targets[k]] = ninsts;
+                ninsts += block_size(&prog->insts[targets[k]]);
+                queue[tail++] = targets[k];
+            }
+        }
+    }
+    insts = malloc(ninsts * sizeof (Inst));
+    inloop = malloc(ninsts * sizeof (int));
+    for (i = 0; i < tail; i++) {
+        pc = queue[i];
+        n = block_size(&prog->insts[pc]);
+        memcpy(insts + map[pc], prog->insts + pc, n * sizeof (Inst));
+        memcpy(inloop + map[pc], prog->inloop + pc, n * sizeof (int));
+        for (inst = insts + map[pc]; inst < insts + map[pc] + n; inst++) {
+            if (has_out(inst))
+                inst->out = map[inst->out];
+            if (inst->op == OP_CALL)
+                inst->arg = map[inst->arg];
+        }
+    }
+    free(prog->insts);
+    free(prog->inloop);
+    free(map);
+    free(queue);
+    prog->insts = insts;
+    prog->inloop = inloop;
+    prog->ninsts = ninsts;
+    prog->start = 0;
+    prog->loopdepth = 0;
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        inst = &prog->insts[pc];
+        if (inst->op == OP_LOOP &&
+            prog->loops[inst->arg].depth > prog->loopdepth)
+            prog->loopdepth = prog->loops[inst->arg].depth;
+    }
+}
+
+/* Refines the byte classes so that bytes in the set and bytes out of it
+are never in the same class.  */
+static void
+split_bytes (Prog *prog, const unsigned char *in) {
+    int map[512];
+    int b, key, n = 0;
+    for (key = 0; key < 512; key++)
+        map[key] = -1;
+    for (b = 0; b < 256; b++) {
+        key = 2 * prog->bytemap[b] + !!in[b];
+        if (map[key] < 0)
+            map[key] = n++;
+        prog->bytemap[b] = map[key];
+    }
+    prog->nbytes = n;
+}
+
+/* Groups bytes that no instruction can tell apart, so an automaton only
+needs a transition per group instead of one per byte.  */
+static void
+byte_classes (Prog *prog) {
+    unsigned char chars[256] = {0}, in[256];
+    unsigned int pc;
+    int b, i;
+    memset(prog->bytemap, 0, sizeof prog->bytemap);
+    prog->nbytes = 1;
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        Inst *inst = &prog->insts[pc];
+        if (inst->op == OP_CHAR || inst->op == OP_NCHAR)
+            chars[inst->arg] = 1;
+        else if (inst->op == OP_ASSERT)
+            prog->nasserts++;
+    }
+    for (b = 0; b < 256; b++) {
+        if (!chars[b])
+            continue;
+        memset(in, 0, sizeof in);
+        in[b] = 1;
+        split_bytes(prog, in);
+    }
+    for (i = 0; i < prog->nclasses; i++) {
+        for (b = 0; b < 256; b++)
+            in[b] = char_class_match(prog->classes[i], b);
+        split_bytes(prog, in);
+    }
+    if (prog->nasserts) {
+        for (b = 0; b < 256; b++)
+            in[b] = b == '\n';
+        split_bytes(prog, in);
+        for (b = 0; b < 256; b++)
+            in[b] = isword(b);
+        split_bytes(prog, in);
+    }
+}
+
+/* Collects the chars every path from the start has to begin with.  */
+static void
+literal_prefix (Prog *prog) {
+    unsigned int pc = prog->start;
+    while (prog->nprefix < PREFIX_MAX) {
+        if (prog->insts[pc].op == OP_JMP || prog->insts[pc].op == OP_SAVE) {
+            pc = prog->insts[pc].out;
+            continue;
+        }
+        if (prog->insts[pc].op != OP_CHAR)
+            break;
+        prog->prefix[prog->nprefix++] = prog->insts[pc].arg;
+        pc = prog->insts[pc].out;
+    }
+}
+
+/* Puts the instructions reachable from the start in reverse postorder,
+without going into calls, and returns how many there are. number maps
+each pc to its place in the order, or -1 if it isn't reachable.  */
+static int
+reverse_postorder (Prog *prog, unsigned int *order, int *number) {
+    unsigned int *stack = malloc(prog->ninsts * sizeof (unsigned int));
+    int *next = malloc(prog->ninsts * sizeof (int));
+    unsigned int pc, to;
+    int top = 0, n = prog->ninsts;
+    for (pc = 0; pc < prog->ninsts; pc++)
+        number[pc] = -1;
+    stack[top++] = prog->start;
+    number[prog->start] = -2;
+    next[prog->start] = 0;
+    while (top) {
+        pc = stack[top - 1];
+        if (next[pc] < nsuccs(&prog->insts[pc])) {
+            to = succ(prog, pc, next[pc]++);
+            if (number[to] == -1) {
+                number[to] = -2;
+                next[to] = 0;
+                stack[top++] = to;
+            }
+            continue;
+        }
+        top--;
+        order[--n] = pc;
+    }
+    memmove(order, order + n, (prog->ninsts - n) * sizeof (unsigned int));
+    n = prog->ninsts - n;
+    for (pc = 0; pc < n; pc++)
+        number[order[pc]] = pc;
+    free(stack);
+    free(next);
+    return n;
+}
+
+static int
+intersect (int *idom, int a, int b, long *steps) {
+    while (a != b) {
+        while (a > b) {
+            a = idom[a];
+            (*steps)++;
+        }
+        while (b > a) {
+            b = idom[b];
+            (*steps)++;
+        }
+    }
+    return a;
+}
+
+/* Marks the instructions every path from the start to OP_MATCH goes
+through, using the algorithm of Cooper, Harvey and Kennedy with an
+extra node after every OP_MATCH. That can take time quadratic in the
+size of the program, as for a long run of optional copies of an atom,
+so it gives up and marks nothing after DOMINATORS_MAX_STEPS.  */
+static void
+dominators (Prog *prog, char *required) {
+    unsigned int *order = malloc(prog->ninsts * sizeof (unsigned int));
+    int *number = malloc(prog->ninsts * sizeof (int));
+    int *idom, n, i, j, d, meet, changed = 1, exit;
+    long steps = 0;
+    unsigned int pc;
+    Inst *inst;
+    n = reverse_postorder(prog, order, number);
+    exit = n;
+    idom = malloc((n + 1) * sizeof (int));
+    for (i = 0; i <= n; i++)
+        idom[i] = -1;
+    idom[0] = 0;
+    while (changed && steps < DOMINATORS_MAX_STEPS) {
+        changed = 0;
+        /* Rather than meeting the predecessors of each instruction,
+        each instruction is met into its successors.  */
+        for (i = 0; i < n && steps < DOMINATORS_MAX_STEPS; i++) {
+            if (idom[i] < 0)
+                continue;
+            pc = order[i];
+            inst = &prog->insts[pc];
+            for (j = 0; j < (nsuccs(inst) > 1 ? nsuccs(inst) : 1); j++) {
+                if (nsuccs(inst))
+                    d = number[succ(prog, pc, j)];
+                else if (inst->op == OP_MATCH)
+                    d = exit;
+                else
+                    continue;
+                if (d == 0)
+                    continue;
+                meet = idom[d] < 0 ? i : intersect(idom, idom[d], i, &steps);
+                if (meet != idom[d]) {
+                    idom[d] = meet;
+                    changed = 1;
+                }
+            }
+        }
+    }
+    if (steps < DOMINATORS_MAX_STEPS && idom[exit] >= 0) {
+        for (d = idom[exit]; d; d = idom[d])
+            required[order[d]] = 1;
+        required[order[0]] = 1;
+    }
+    free(order);
+    free(number);
+    free(idom);
+}
+
+/* Collects runs of required OP_CHARs that follow each other, keeping
+the longest FACTORS_MAX of them. A run at the start is the prefix
+already, and isn't kept again.  */
+static void
+required_factors (Prog *prog) {
+    char *required = calloc(prog->ninsts, 1);
+    char *inner = calloc(prog->ninsts, 1);
+    unsigned int pc, next;
+    Factor f, tmp;
+    int i;
+    dominators(prog, required);
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        if (!required[pc] || prog->insts[pc].op != OP_CHAR)
+            continue;
+        next = follow(prog, prog->insts[pc].out);
+        if (required[next] && prog->insts[next].op == OP_CHAR)
+            inner[next] = 1;
+    }
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        if (!required[pc] || inner[pc] || prog->insts[pc].op != OP_CHAR ||
+            prog->nprefix && pc == follow(prog, prog->start))
+            continue;
+        f.length = 0;
+        for (next = pc; f.length < PREFIX_MAX; ) {
+            f.str[f.length++] = prog->insts[next].arg;
+            next = follow(prog, prog->insts[next].out);
+            if (!required[next] || prog->insts[next].op != OP_CHAR ||
+                next == pc)
+                break;
+        }
+        /* Insertion into the factors, longest first.  */
+        for (i = 0; i < prog->nfactors; i++) {
+            if (f.length > prog->factors[i].length) {
+                tmp = prog->factors[i];
+                prog->factors[i] = f;
+                f = tmp;
+            }
+        }
+        if (prog->nfactors < FACTORS_MAX)
+            prog->factors[prog->nfactors++] = f;
+    }
+    free(required);
+    free(inner);
+}
+
+/* Returns whether the string has every factor the program needs.  */
+int
+prog_has_factors (Prog *prog, const char *str, size_t len) {
+    int i;
+    for (i = 0; i < prog->nfactors; i++) {
+        if (prog->factors[i].length == 1 ?
+            !memchr(str, prog->factors[i].str[0], len) :
+            !memmem(str, len, prog->factors[i].str, prog->factors[i].length))
+            return 0;
+    }
+    return 1;
+}
+
+/* Collects the chars a match can begin with, going through everything
+that doesn't eat a char. Returns 0 if a match could be empty or begin
+in a call, when any char could come first, or begin with an assertion,
+which the DFAs can't check after skipping since they only know the char
+before the place they skipped to from their state.  */
+static int
+first_chars (Prog *prog, unsigned int pc, char *seen, unsigned char *bits) {
+    Inst *inst;
+    unsigned int i;
+    int c;
+    while (!seen[pc]) {
+        seen[pc] = 1;
+        inst = &prog->insts[pc];
+        switch (inst->op) {
+            case OP_FORK:
+                for (i = 1; i <= inst->arg; i++) {
+                    if (!first_chars(prog, pc + i, seen, bits))
+                        return 0;
+                }
+                return 1;
+            case OP_REPEAT:
+                if (!first_chars(prog, pc + 1, seen, bits))
+                    return 0;
+                pc = inst->out;
+                continue;
+            case OP_JMP:
+            case OP_LOOP:
+            case OP_PROGRESS:
+            case OP_SAVE:
+            case OP_COUNT:
+                pc = inst->out;
+                continue;
+            case OP_CHAR:
+                bits[inst->arg >> 3] |= 1 << (inst->arg & 7);
+                return 1;
+            case OP_ANY:
+            case OP_NCHAR:
+                for (c = 0; c < 256; c++) {
+                    if (inst->op == OP_ANY || c != inst->arg)
+                        bits[c >> 3] |= 1 << (c & 7);
+                }
+                return 1;
+            case OP_CLASS:
+                for (c = 0; c < 32; c++)
+                    bits[c] |= prog->classes[inst->arg]->bits[c];
+                return 1;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Works out how the engines can skip ahead to where a match might
+start, if they can.  */
+static void
+start_skip (Prog *prog) {
+    unsigned char bits[32] = {0};
+    char *seen;
+    int c, n = 0;
+    prog->sets = malloc(prog->nclasses * sizeof (ByteSet));
+    for (c = 0; c < prog->nclasses; c++)
+        byte_set_init(&prog->sets[c], prog->classes[c]->bits);
+    if (prog->anchored)
+        return;
+    if (prog->nprefix) {
+        prog->skip = 1;
+        return;
+    }
+    seen = calloc(prog->ninsts, 1);
+    if (first_chars(prog, prog->start, seen, bits)) {
+        for (c = 0; c < 256; c++)
+            n += bits[c >> 3] >> (c & 7) & 1;
+        if (n < 256) {
+            byte_set_init(&prog->first, bits);
+            prog->skip = 1;
+        }
+    }
+    free(seen);
+}
+
+/* Returns the next place from pos on, before end, where a match could
+start, or NULL if there isn't one.  */
+const char *
+prog_find_start (Prog *prog, const char *pos, const char *end) {
+    if (!prog->nprefix)
+        return byte_set_find(&prog->first, pos, end);
+    if (prog->nprefix == 1)
+        return memchr(pos, prog->prefix[0], end - pos);
+    return memmem(pos, end - pos, prog->prefix, prog->nprefix);
+}
+
+/* Compiles the regex with bounds over unroll counted, unless that takes
+more than budget instructions, when it gives up and returns NULL.  */
+static Prog *
+compile (Rx *rx, unsigned int unroll, unsigned int budget) {
+    Compiler c = {0};
+    Scope *scope, *next;
+    int i;
+    c.prog = calloc(1, sizeof (Prog));
+    c.root = rx;
+    c.unroll = unroll;
+    c.budget = budget;
+    c.nsubs = rx->captures.n + 1;
+    c.prog->ncaptures = rx->captures.n;
+    c.subs = malloc(c.nsubs * sizeof (unsigned int));
+    for (i = 0; i < c.nsubs; i++)
+        c.subs[i] = INST_NONE;
+    scope = scope_new(&c, SCOPE_TOP, 0, -1);
+    c.prog->start = ref(&c, scope, rx->start);
+    while (c.nwork && !c.over) {
+        Pending p = c.work[--c.nwork];
+        fill(&c, &p);
+    }
+    for (scope = c.scopes; scope; scope = next) {
+        next = scope->next;
+        scope_free(scope);
+    }
+    free(c.work);
+    if (c.over) {
+        free(c.subs);
+        prog_free(c.prog);
+        return NULL;
+    }
+    compact(c.prog, c.subs, c.nsubs);
+    free(c.subs);
+    return c.prog;
+}
+
+/* Unrolls every quantifier if the program fits in UNROLL_BUDGET, so that
+the automata can run it. Otherwise it counts the quantifiers with the
+largest bounds, then ever smaller ones, until it does fit, or counts
+every bound over one.  */
+Prog *
+prog_new (Rx *rx) {
+    int i, n = sizeof unroll_max / sizeof unroll_max[0];
+    Prog *prog = NULL;
+    for (i = 0; !prog; i++)
+        prog = compile(rx, unroll_max[i], i < n - 1 ? UNROLL_BUDGET : 0);
+    byte_classes(prog);
+    prog->anchored = prog->insts[0].op == OP_ASSERT &&
+                     prog->insts[0].arg == ASSERT_BOS;
+    literal_prefix(prog);
+    required_factors(prog);
+    start_skip(prog);
+    return prog;
+}
+
+/* Joins the programs of several regexes into one that tries them all
+at once, behind a fork with an alternative for each. The OP_MATCH of
+each program holds the id it was given, so that an engine can tell
+which of them matched. The programs must not make calls or count.  */
+Prog *
+prog_union (Prog **progs, int *ids, int n) {
+    Prog *prog = calloc(1, sizeof (Prog));
+    unsigned int base = n + 1, pc;
+    int i, k, nclasses = 0, nloops = 0;
+    Inst *inst;
+    for (i = 0; i < n; i++) {
+        prog->ninsts += progs[i]->ninsts;
+        prog->nclasses += progs[i]->nclasses;
+        prog->nloops += progs[i]->nloops;
+    }
+    prog->ninsts += base;
+    prog->insts = malloc(prog->ninsts * sizeof (Inst));
+    prog->inloop = malloc(prog->ninsts * sizeof (int));
+    prog->loops = malloc((prog->nloops + 1) * sizeof (Loop));
+    prog->classes = malloc(prog->nclasses * sizeof (CharClass *));
+    prog->insts[0].op = OP_FORK;
+    prog->insts[0].out = 0;
+    prog->insts[0].arg = n;
+    prog->inloop[0] = -1;
+    for (i = 0; i < n; i++) {
+        inst = &prog->insts[1 + i];
+        inst->op = OP_JMP;
+        inst->out = base + progs[i]->start;
+        inst->arg = 0;
+        prog->inloop[1 + i] = -1;
+        memcpy(prog->insts + base, progs[i]->insts,
+               progs[i]->ninsts * sizeof (Inst));
+        memcpy(prog->classes + nclasses, progs[i]->classes,
+               progs[i]->nclasses * sizeof (CharClass *));
+        if (progs[i]->nloops) {
+            memcpy(prog->loops + nloops, progs[i]->loops,
+                   progs[i]->nloops * sizeof (Loop));
+        }
+        for (k = nloops; k < nloops + progs[i]->nloops; k++) {
+            if (prog->loops[k].outer >= 0)
+                prog->loops[k].outer += nloops;
+        }
+        if (progs[i]->loopdepth > prog->loopdepth)
+            prog->loopdepth = progs[i]->loopdepth;
+        for (pc = base; pc < base + progs[i]->ninsts; pc++) {
+            inst = &prog->insts[pc];
+            prog->inloop[pc] = progs[i]->inloop[pc - base];
+            if (prog->inloop[pc] >= 0)
+                prog->inloop[pc] += nloops;
+            if (has_out(inst))
+                inst->out += base;
+            if (inst->op == OP_CLASS)
+                inst->arg += nclasses;
+            else if (inst->op == OP_LOOP || inst->op == OP_PROGRESS)
+                inst->arg += nloops;
+            else if (inst->op == OP_MATCH)
+                inst->arg = ids[i];
+        }
+        base += progs[i]->ninsts;
+        nclasses += progs[i]->nclasses;
+        nloops += progs[i]->nloops;
+    }
+    prog->nloops = nloops;
+    prog->nmatches = n;
+    byte_classes(prog);
+    required_factors(prog);
+    start_skip(prog);
+    return prog;
+}
+
+void
+prog_free (Prog *prog) {
+    if (!prog)
+        return;
+    free(prog->insts);
+    free(prog->inloop);
+    free(prog->classes);
+    free(prog->sets);
+    free(prog->counters);
+    free(prog->loops);
+    free(prog);
+}
+
+void
+prog_print (Prog *prog) {
+    static const char *names[] = {
+        "match", "fork", "jmp", "char", "any", "nchar", "class", "assert",
+        "call", "ret", "loop", "progress", "fail", "save", "count", "repeat"
+    };
+    unsigned int pc;
+    int i;
+    for (pc = 0; pc < prog->ninsts; pc++) {
+        Inst *inst = &prog->insts[pc];
+        printf("%4u %-8s", pc, names[inst->op]);
+        switch (inst->op) {
+            case OP_CHAR:
+            case OP_NCHAR:
+                printf(" '%c' -> %u", inst->arg, inst->out);
+                break;
+            case OP_CLASS:
+                printf(" %.*s -> %u", prog->classes[inst->arg]->length,
+                    prog->classes[inst->arg]->str, inst->out);
+                break;
+            case OP_FORK:
+                printf(" %u", inst->arg);
+                break;
+            case OP_ASSERT:
+            case OP_CALL:
+            case OP_LOOP:
+            case OP_PROGRESS:
+            case OP_SAVE:
+            case OP_COUNT:
+                printf(" %u -> %u", inst->arg, inst->out);
+                break;
+            case OP_REPEAT:
+                printf(" %u %u..%u%s -> %u", inst->arg,
+                    prog->counters[inst->arg].min, prog->counters[inst->arg].max,
+                    prog->counters[inst->arg].frugal ? "?" : "", inst->out);
+                break;
+            case OP_ANY:
+            case OP_JMP:
+                printf(" -> %u", inst->out);
+                break;
+        }
+        printf("\n");
+    }
+    if (prog->nprefix)
+        printf("prefix '%.*s'\n", prog->nprefix, prog->prefix);
+    for (i = 0; i < prog->nfactors; i++) {
+        printf("factor '%.*s'\n", prog->factors[i].length,
+            prog->factors[i].str);
+    }
+}
@@ -3,37 +3,167 @@ Perl 5, and Perl 6. */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include "rxpriv.h"
 
 Rx *
 rx_new (const char *regex) {
-    Rx *rx = calloc(1, sizeof (Rx));
+    return rx_new_with(regex, NULL);
+}
+
+Rx *
+rx_new_with (const char *regex, const RxOptions *options) {
+    RxOptions defaults = {0};
+    Arena *arena = arena_new();
+    Rx *rx = arena_alloc(arena, sizeof (Rx));
+    if (!options)
+        options = &defaults;
+    rx->arena = arena;
     rx->regex = regex;
     if (!rx_parse(rx)) {
         rx_free(rx);
         return NULL;
     }
+    if (!options->no_simplify)
+        rx_simplify(rx);
+    rx->prog = prog_new(rx);
+    rx->prog->debug = options->debug;
+    rx->prog->stack_limit = options->backtrack_stack;
+    if (options->debug)
+        prog_print(rx->prog);
+    if (options->full_dfa) {
+        rx->full = full_dfa_new(rx->prog, options->full_dfa_states ?
+                                options->full_dfa_states : 10000);
+    }
+    rx->dfa_cache = options->dfa_cache;
+    rx->scratch = rx_scratch_new(rx);
     return rx;
 }
 
+/* The regex and everything the parser made for it, down to the groups
+in it, are in its arena. So is the program of a loaded regex.  */
 void
 rx_free (Rx *rx) {
-    list_free(rx->states, state_free);
-    list_free(rx->captures, rx_free);
-    list_free(rx->clusters, rx_free);
-    list_free(rx->subrules, rx_free);
-    list_free(rx->extends, NULL);
-    list_free(rx->charclasses, char_class_free);
-    list_free(rx->quantifications, NULL);
-    free(rx);
+    rx_scratch_free(rx->scratch);
+    if (!rx->loaded) {
+        full_dfa_free(rx->full);
+        prog_free(rx->prog);
+    }
+    arena_free(rx->arena);
+}
+
+int
+rx_match (Rx *rx, const char *str) {
+    return rx_match_n(rx, str, strlen(str));
+}
+
+/* Matches against the len bytes at buf, which can hold NULs and needn't
+end in one. $ and $$ match at buf + len.  */
+int
+rx_match_n (Rx *rx, const char *buf, size_t len) {
+    return rx_exec(rx, buf, len, NULL, 0);
+}
+
+/* Matches like rx_match_n() and fills in the first nspans spans with
+where the match begins and ends, then where each (...) group of the
+regex did, numbered from 1 in the order of their '(' like for <~~N>.
+Groups inside other groups don't get a number. A group the match didn't
+go through is -1..-1, and so is any span past the last group.  */
+int
+rx_exec (Rx *rx, const char *str, size_t len, RxSpan *spans, int nspans) {
+    RxScratch *scratch = scratch_take(&rx->scratch);
+    int retval;
+    if (!scratch)
+        scratch = rx_scratch_new(rx);
+    retval = rx_match_with(rx, scratch, str, len, spans, nspans);
+    scratch_put(&rx->scratch, scratch);
+    return retval;
+}
+
+/* Matches like rx_exec(), keeping everything that changes while matching
+in scratch instead of in the regex. The scratch is fitted to the regex
+first if it wasn't already. With no spans to fill in, the lazy DFA can
+answer, otherwise the Pike VM has to run, after the full DFA if there
+is one has ruled out there being no match at all. Returns -1 if the
+backtracker had to run and ran out of stack.  */
+int
+rx_match_with (Rx *rx, RxScratch *scratch, const char *buf, size_t len,
+               RxSpan *spans, int nspans) {
+    Prog *prog = rx->prog;
+    const size_t *offsets;
+    const char **slots;
+    size_t beg, end;
+    Fitted *fitted;
+    int i, retval;
+    for (i = 0; i < nspans; i++)
+        spans[i].beg = spans[i].end = -1;
+    if (!prog_has_factors(prog, buf, len))
+        return 0;
+    if (!(fitted = scratch_fitted(scratch, prog)))
+        fitted = scratch_fit(scratch, prog,
+                             !prog_backtrack_only(prog) && !rx->full,
+                             rx->dfa_cache);
+    if (prog_backtrack_only(prog)) {
+        slots = scratch->slots;
+        retval = backtrack_exec(prog, buf, len, slots, 2 + 2 * prog->ncaptures,
+                                &scratch->backtrack);
+        if (retval <= 0)
+            return retval;
+        for (i = 0; i < nspans && i <= prog->ncaptures; i++) {
+            if (!slots[2 * i] || !slots[2 * i + 1])
+                continue;
+            spans[i].beg = slots[2 * i] - buf;
+            spans[i].end = slots[2 * i + 1] - buf;
+        }
+        return 1;
+    }
+    if (rx->full) {
+        retval = full_dfa_match(rx->full, buf, len);
+        if (!retval || !nspans)
+            return retval;
+    }
+    else if (!nspans) {
+        retval = lazy_dfa_match(fitted->dfa, buf, len);
+        if (retval >= 0)
+            return retval;
+    }
+    pike_reset(scratch->pike, prog);
+    pike_feed(scratch->pike, buf, len);
+    if (!pike_finish(scratch->pike, &beg, &end))
+        return 0;
+    offsets = pike_slots(scratch->pike);
+    for (i = 0; i < nspans && i <= prog->ncaptures; i++) {
+        if (offsets[2 * i] == (size_t) -1 || offsets[2 * i + 1] == (size_t) -1)
+            continue;
+        spans[i].beg = offsets[2 * i];
+        spans[i].end = offsets[2 * i + 1];
+    }
+    return 1;
+}
+
+/* Reports on the lazy DFA in the regex's own scratch, the one rx_match()
+uses, unless another thread is matching with it right now.  */
+void
+rx_stats (Rx *rx, RxStats *stats) {
+    RxScratch *scratch = scratch_take(&rx->scratch);
+    Fitted *fitted;
+    stats->dfa_hits = stats->dfa_misses = stats->dfa_flushes = 0;
+    if (!scratch)
+        return;
+    fitted = scratch_fitted(scratch, rx->prog);
+    if (fitted && fitted->dfa)
+        lazy_dfa_stats(fitted->dfa, &stats->dfa_hits, &stats->dfa_misses,
+                       &stats->dfa_flushes);
+    scratch_put(&rx->scratch, scratch);
 }
 
 Rx *
 rx_extend (Rx *parent) {
-    Rx *rx = calloc(1, sizeof (Rx));
+    Rx *rx = arena_alloc(parent->arena, sizeof (Rx));
+    rx->arena = parent->arena;
     rx->regex = parent->regex;
-    rx->extends = list_push(rx->extends, parent);
+    vec_push(rx->arena, &rx->extends, parent);
     rx->end = rx->start = state_new(rx);
     return rx;
 }
@@ -60,7 +190,8 @@ set_lookup (void **set, int n, void *key) {
 
 static void
 rx_print_state (Rx *rx, State *state, int backwards, void **visited, int n) {
-    List *elem;
+    Vec *transitions;
+    int i;
     if (!state)
         return;
     if (set_lookup(visited, n, state))
@@ -72,9 +203,9 @@ rx_print_state (Rx *rx, State *state, int backwards, void **visited, int n) {
     if (rx->end == state)
         printf(" [fillcolor=yellow,style=filled]");
     printf("\n");
-    elem = backwards ? state->backtransitions : state->transitions;
-    for (; elem; elem = elem->next) {
-        Transition *t = elem->data;
+    transitions = backwards ? &state->backtransitions : &state->transitions;
+    for (i = 0; i < transitions->n; i++) {
+        Transition *t = transitions->items[i];
         printf("\"%p\" -> \"%p\"", state, t->to);
         if (t->type & (CHAR | ANYCHAR) && isgraph(POINTER_TO_INT(t->param))) {
             printf(" [label=\"%c\"]", POINTER_TO_INT(t->param));
@@ -86,7 +217,8 @@ rx_print_state (Rx *rx, State *state, int backwards, void **visited, int n) {
         }
         else if (t->type & QUANTIFIED) {
             Quantified *q = t->param;
-            printf(" [label=\"qfy %d..%d to %p\"]", q->min, q->max, t->ret);
+            printf(" [label=\"qfy %d..%d%s to %p\"]",
+                q->min, q->max, q->frugal ? "?" : "", t->ret);
         }
         else if (t->ret) {
             printf(" [label=\"return to %p\"]", t->ret);
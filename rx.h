@@ -1,14 +1,83 @@
 #ifndef __RX_H__
 #define __RX_H__
 
-int rx_debug;
+#include <stddef.h>
 
 typedef struct Rx Rx;
+typedef struct RxSet RxSet;
+typedef struct RxStream RxStream;
+typedef struct RxScratch RxScratch;
+typedef struct RxCache RxCache;
+
+typedef struct {
+    size_t dfa_cache;
+    int    full_dfa;
+    int    full_dfa_states;
+    int    debug;
+    int    no_simplify;
+    size_t backtrack_stack;
+} RxOptions;
+
+typedef struct {
+    unsigned long dfa_hits;
+    unsigned long dfa_misses;
+    unsigned long dfa_flushes;
+} RxStats;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t        regexes;
+    size_t        bytes;
+} RxCacheStats;
+
+typedef struct {
+    ptrdiff_t beg;
+    ptrdiff_t end;
+} RxSpan;
 
 Rx   *rx_new             (const char *regex);
+Rx   *rx_new_with        (const char *regex, const RxOptions *options);
 void  rx_free            (Rx *rx);
 int   rx_match           (Rx *rx, const char *str);
+int   rx_match_n         (Rx *rx, const char *buf, size_t len);
+int   rx_exec            (Rx *rx, const char *str, size_t len,
+                          RxSpan *spans, int nspans);
+int   rx_match_with      (Rx *rx, RxScratch *scratch, const char *buf,
+                          size_t len, RxSpan *spans, int nspans);
+void  rx_stats           (Rx *rx, RxStats *stats);
 void  rx_print           (Rx *rx, int backwards);
 
+size_t rx_serialize (Rx *rx, void *buf, size_t size);
+Rx    *rx_load      (const void *blob, size_t len);
+
+RxScratch *rx_scratch_new  (Rx *rx);
+void       rx_scratch_fit  (RxScratch *scratch, Rx *rx);
+void       rx_scratch_free (RxScratch *scratch);
+RxScratch *rx_set_scratch_new (RxSet *set);
+
+RxSet *rx_set_new        (const RxOptions *options);
+void   rx_set_free       (RxSet *set);
+int    rx_set_add        (RxSet *set, const char *regex);
+void   rx_set_compile    (RxSet *set);
+int    rx_set_match      (RxSet *set, const char *str, int *ids, int nids);
+int    rx_set_match_n    (RxSet *set, const char *buf, size_t len,
+                          int *ids, int nids);
+int    rx_set_match_with (RxSet *set, RxScratch *scratch, const char *buf,
+                          size_t len, int *ids, int nids);
+void   rx_set_stats      (RxSet *set, RxStats *stats);
+
+RxCache *rx_cache_new     (size_t capacity);
+void     rx_cache_free    (RxCache *cache);
+Rx      *rx_cache_get     (RxCache *cache, const char *regex);
+void     rx_cache_release (RxCache *cache, Rx *rx);
+void     rx_cache_stats   (RxCache *cache, RxCacheStats *stats);
+
+RxStream *rx_stream_new    (Rx *rx);
+void      rx_stream_free   (RxStream *stream);
+int       rx_stream_feed   (RxStream *stream, const char *chunk, size_t len);
+int       rx_stream_finish (RxStream *stream, size_t *beg, size_t *end);
+
 #endif
 
@@ -4,21 +4,25 @@
 
 int
 main (int argc, char **argv) {
+    RxOptions options = {0};
     char *regex;
     Rx *rx;
     int backwards = 0;
     char opt;
-    while ((opt = getopt(argc, argv, "b")) != -1) {
+    while ((opt = getopt(argc, argv, "br")) != -1) {
         if (opt == 'b') {
             backwards = 1;
         }
+        else if (opt == 'r') {
+            options.no_simplify = 1;
+        }
     }
     if (argc - optind != 1) {
-        fprintf(stderr, "usage: ./rxdot <regex>\n");
+        fprintf(stderr, "usage: ./rxdot [-b] [-r] <regex>\n");
         return 1;
     }
     regex = argv[optind];
-    rx = rx_new(regex);
+    rx = rx_new_with(regex, &options);
     if (!rx)
         return 0;
     rx_print(rx, backwards);
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rx.h"
+
+/*
+Prints the lines of files that match a regex. Each file is mapped into
+memory and cut into chunks of about CHUNK_SIZE bytes that end at a
+newline, and a pool of threads takes chunks off a shared counter and
+matches their lines, each thread with its own RxScratch. A chunk keeps
+where its matching lines are and how many lines it has, and the main
+thread prints the chunks in order as they are done, so the output is
+the same as if one thread had read the files from start to end.
+*/
+
+#define CHUNK_SIZE (1 << 20)
+
+typedef struct {
+    size_t beg;
+    size_t end;
+    size_t line;
+} Line;
+
+typedef struct {
+    int     file;
+    size_t  beg;
+    size_t  end;
+    size_t  nlines;
+    Line   *lines;
+    size_t  n;
+    size_t  size;
+    int     done;
+} Chunk;
+
+typedef struct {
+    const char *name;
+    const char *buf;
+    size_t      len;
+    int         mapped;
+    int         opened;
+} File;
+
+static Rx *rx;
+static File *files;
+static Chunk *chunks;
+static int nchunks;
+static int next;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+static void
+match_chunk (RxScratch *scratch, Chunk *chunk) {
+    const char *buf = files[chunk->file].buf;
+    const char *pos = buf + chunk->beg, *end = buf + chunk->end, *eol;
+    for (; pos < end; pos = eol + 1) {
+        if (!(eol = memchr(pos, '\n', end - pos)))
+            eol = end;
+        if (rx_match_with(rx, scratch, pos, eol - pos, NULL, 0) > 0) {
+            if (chunk->n == chunk->size) {
+                chunk->size = chunk->size ? 2 * chunk->size : 64;
+                chunk->lines = realloc(chunk->lines,
+                                       chunk->size * sizeof (Line));
+            }
+            chunk->lines[chunk->n].beg = pos - buf;
+            chunk->lines[chunk->n].end = eol - buf;
+            chunk->lines[chunk->n].line = chunk->nlines;
+            chunk->n++;
+        }
+        chunk->nlines++;
+    }
+}
+
+static void *
+worker (void *arg) {
+    RxScratch *scratch = rx_scratch_new(rx);
+    int i;
+    while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < nchunks) {
+        match_chunk(scratch, &chunks[i]);
+        pthread_mutex_lock(&lock);
+        chunks[i].done = 1;
+        pthread_cond_broadcast(&finished);
+        pthread_mutex_unlock(&lock);
+    }
+    rx_scratch_free(scratch);
+    return NULL;
+}
+
+static int
+open_file (File *file) {
+    struct stat st;
+    size_t size = 0;
+    char *buf = NULL;
+    ssize_t n;
+    int fd = file->name ? open(file->name, O_RDONLY) : 0;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(file->name);
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        file->len = st.st_size;
+        if (file->len) {
+            file->buf = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (file->buf == MAP_FAILED) {
+                perror(file->name);
+                close(fd);
+                return 0;
+            }
+            madvise((void *) file->buf, file->len, MADV_SEQUENTIAL);
+            file->mapped = 1;
+        }
+    }
+    else {
+        /* Pipes can't be mapped, so they are read in whole.  */
+        while (1) {
+            if (file->len == size) {
+                size = size ? 2 * size : 1 << 16;
+                buf = realloc(buf, size);
+            }
+            if ((n = read(fd, buf + file->len, size - file->len)) <= 0)
+                break;
+            file->len += n;
+        }
+        file->buf = buf;
+    }
+    if (fd)
+        close(fd);
+    return file->opened = 1;
+}
+
+/* Cuts a file into chunks that end just after a newline, or at the end
+of the file.  */
+static void
+add_chunks (int f, int *size) {
+    File *file = &files[f];
+    const char *nl;
+    size_t beg = 0, end;
+    while (beg < file->len) {
+        end = beg + CHUNK_SIZE;
+        if (end >= file->len)
+            end = file->len;
+        else if ((nl = memchr(file->buf + end, '\n', file->len - end)))
+            end = nl - file->buf + 1;
+        else
+            end = file->len;
+        if (nchunks == *size) {
+            *size = *size ? 2 * *size : 64;
+            chunks = realloc(chunks, *size * sizeof (Chunk));
+        }
+        memset(&chunks[nchunks], 0, sizeof (Chunk));
+        chunks[nchunks].file = f;
+        chunks[nchunks].beg = beg;
+        chunks[nchunks].end = end;
+        nchunks++;
+        beg = end;
+    }
+}
+
+static void
+usage (void) {
+    fprintf(stderr, "usage: ./rxgrep [-n] [-c] [-j threads] regex [file...]\n");
+    exit(2);
+}
+
+int
+main (int argc, char **argv) {
+    int number = 0, count = 0, nthreads, nfiles, size = 0;
+    int i, f, opt, errors = 0, names;
+    size_t line, matches, total = 0, k;
+    pthread_t *threads;
+    Chunk *chunk;
+    Line *l;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "ncj:")) != -1) {
+        switch (opt) {
+            case 'n': number = 1; break;
+            case 'c': count = 1; break;
+            case 'j': nthreads = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+    if (nthreads < 1)
+        nthreads = 1;
+    if (!(rx = rx_new(argv[optind++])))
+        return 2;
+    nfiles = argc - optind;
+    names = nfiles > 1;
+    files = calloc(nfiles ? nfiles : 1, sizeof (File));
+    for (f = 0; f < nfiles; f++)
+        files[f].name = argv[optind + f];
+    /* With no files, stdin is read.  */
+    if (!nfiles)
+        nfiles = 1;
+    for (f = 0; f < nfiles; f++) {
+        if (open_file(&files[f]))
+            add_chunks(f, &size);
+        else
+            errors++;
+    }
+
+    threads = malloc(nthreads * sizeof (pthread_t));
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (f = 0, i = 0; f < nfiles; f++) {
+        line = 0;
+        matches = 0;
+        for (; i < nchunks && chunks[i].file == f; i++) {
+            chunk = &chunks[i];
+            pthread_mutex_lock(&lock);
+            while (!chunk->done)
+                pthread_cond_wait(&finished, &lock);
+            pthread_mutex_unlock(&lock);
+            for (k = 0; !count && k < chunk->n; k++) {
+                l = &chunk->lines[k];
+                if (names)
+                    printf("%s:", files[f].name);
+                if (number)
+                    printf("%zu:", line + l->line + 1);
+                fwrite(files[f].buf + l->beg, 1, l->end - l->beg, stdout);
+                putchar('\n');
+            }
+            line += chunk->nlines;
+            matches += chunk->n;
+            free(chunk->lines);
+        }
+        if (count && files[f].opened) {
+            if (names)
+                printf("%s:", files[f].name);
+            printf("%zu\n", matches);
+        }
+        if (files[f].mapped)
+            munmap((void *) files[f].buf, files[f].len);
+        else
+            free((void *) files[f].buf);
+        total += matches;
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    free(chunks);
+    free(files);
+    rx_free(rx);
+    return errors ? 2 : total ? 0 : 1;
+}
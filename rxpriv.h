@@ -1,33 +1,38 @@
 #ifndef __RXPRIV_H__
 #define __RXPRIV_H__
 
+#include <stddef.h>
 #include "rx.h"
 
 /* handy  */
 #define INT_TO_POINTER(i) ((void *)(long)(i))
 #define POINTER_TO_INT(p) ((int)(long)(p))
 char *strdupf (const char *fmt, ...);
+void *grow    (void *ptr, size_t *size, size_t want);
 
-/* list  */
-typedef struct List List;
-struct List {
-    void *data;
-    List *next;
-};
+/* arena  */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *blocks;
+    char       *pos;
+    char       *end;
+    size_t      size;
+    size_t      total;
+} Arena;
 
-List *list_push      (List *list, void *data);
-List *list_pop       (List *list, void *dump);
-List *list_shift     (List *list, void *dump);
-List *list_unshift   (List *list, void *data);
-List *list_cat       (List *a, List *b);
-void *list_last_data (List *list);
-void *list_nth_data  (List *list, int n);
-int   list_elems     (List *list);
-List *list_copy      (List *list);
-List *list_free      (List *list, void (*freefunc) ());
-List *list_find      (List *list, void *data, int (*cmpfunc) ());
-List *list_remove    (List *list, void *data, int (*cmpfunc) (),
-                      void (*freefunc) ());
+Arena *arena_new   (void);
+void   arena_free  (Arena *arena);
+void  *arena_alloc (Arena *arena, size_t size);
+
+/* vec  */
+typedef struct {
+    void **items;
+    int    n;
+    int    size;
+} Vec;
+
+void vec_push (Arena *arena, Vec *vec, void *item);
 
 /* charclass  */
 typedef enum {
@@ -37,19 +42,23 @@ typedef enum {
 typedef struct {
     const char *str;
     int length;
-    List *actions;
+    Vec actions;
+    unsigned char bits[32];
 } CharClass;
 
-CharClass *char_class_new   (Rx *rx, const char *str, int length);
-void       char_class_free  (CharClass *cc);
-void       char_class_print (CharClass *cc);
+CharClass *char_class_new     (Rx *rx, const char *str, int length);
+void       char_class_print   (CharClass *cc);
+void       char_class_compile (CharClass *cc);
+
+#define char_class_match(cc, c) \
+    ((cc)->bits[(unsigned char) (c) >> 3] >> ((unsigned char) (c) & 7) & 1)
 
 /* state  */
 typedef struct {
     Rx   *group;
-    List *transitions;
-    List *backtransitions;
-    int (*assertfunc) (const char *str, const char *pos);
+    Vec   transitions;
+    Vec   backtransitions;
+    int (*assertfunc) (const char *str, const char *end, const char *pos);
 } State;
 
 typedef enum {
@@ -72,46 +81,263 @@ typedef struct {
 typedef struct {
     int min;
     int max;
+    int frugal;
 } Quantified;
 
 State      *state_new           (Rx *rx);
 State      *state_split         (State *state);
-void        state_free          (State *state);
 Transition *transition_new      (State *from, State *to, State *ret,
                                  int type, void *param);
-void        transition_free     (Transition *t);
 State      *transition_state    (State *a, State *b, int type, void *param);
 State      *transition_to_group (State *a, State *g, State *h,
                                  int type, void *param);
-void        quantify            (State **a, State **b, int min, int max);
+void        quantify            (State **a, State **b, int min, int max,
+                                 int frugal);
 
 /* assertions  */
+typedef enum {
+    ASSERT_BOS, ASSERT_BOL, ASSERT_EOS, ASSERT_EOL,
+    ASSERT_LWB, ASSERT_RWB, ASSERT_WB, ASSERT_NWB, ASSERT_MAX
+} AssertKind;
+
+/* What an automaton remembers about the char before the position it's
+at, which together with the char after it decides every assertion.  */
+typedef enum {
+    PREV_BOS = 1 << 0, PREV_NL = 1 << 1, PREV_WORD = 1 << 2
+} PrevFlags;
+
+extern int (*assertions[]) (const char *str, const char *end,
+                            const char *pos);
+
+int prev_flags     (int c);
+int assert_context (int kind, int prev, int next);
+
 int isword (int c);
-int bos    (const char *str, const char *pos);
-int bol    (const char *str, const char *pos);
-int eos    (const char *str, const char *pos);
-int eol    (const char *str, const char *pos);
-int lwb    (const char *str, const char *pos);
-int rwb    (const char *str, const char *pos);
-int wb     (const char *str, const char *pos);
-int nwb    (const char *str, const char *pos);
+int bos    (const char *str, const char *end, const char *pos);
+int bol    (const char *str, const char *end, const char *pos);
+int eos    (const char *str, const char *end, const char *pos);
+int eol    (const char *str, const char *end, const char *pos);
+int lwb    (const char *str, const char *end, const char *pos);
+int rwb    (const char *str, const char *end, const char *pos);
+int wb     (const char *str, const char *end, const char *pos);
+int nwb    (const char *str, const char *end, const char *pos);
 
 /* parser  */
 int rx_parse (Rx *rx);
 int ws       (const char *pos, const char **fin);
 
+/* simplify  */
+void rx_simplify (Rx *rx);
+
+/* prog  */
+#define INST_NONE ((unsigned int) -1)
+#define PREFIX_MAX 32
+#define FACTORS_MAX 4
+
+typedef enum {
+    OP_MATCH, OP_FORK, OP_JMP, OP_CHAR, OP_ANY, OP_NCHAR, OP_CLASS,
+    OP_ASSERT, OP_CALL, OP_RET, OP_LOOP, OP_PROGRESS, OP_FAIL, OP_SAVE,
+    OP_COUNT, OP_REPEAT
+} Opcode;
+
+/* An OP_FORK is followed by arg instructions, tried in order. An
+OP_REPEAT is followed by the first instruction of its loop body, and
+leaves the loop for out. Every other instruction continues at out when
+it succeeds. arg holds the char, class index, AssertKind, loop slot,
+OP_CALL target, the capture slot an OP_SAVE stores the position in or
+the counter of an OP_COUNT or OP_REPEAT.  */
+typedef struct {
+    unsigned char op;
+    unsigned int  out;
+    unsigned int  arg;
+} Inst;
+
+typedef struct {
+    int  length;
+    char str[PREFIX_MAX];
+} Factor;
+
+/* How many times the body of a counted loop may go round.  */
+typedef struct {
+    unsigned int min;
+    unsigned int max;
+    int          frugal;
+} Counter;
+
+/* Where a loop lies: the loop whose body it's in, or -1, and how many
+loops deep that makes its own body.  */
+typedef struct {
+    int outer;
+    int depth;
+} Loop;
+
+/* byteset  */
+#define BYTESET_RANGES 4
+
+typedef struct {
+    unsigned char bits[32];
+    int           nranges;
+    unsigned char lo[BYTESET_RANGES];
+    unsigned char width[BYTESET_RANGES];
+    unsigned char table[2][16];
+} ByteSet;
+
+void        byte_set_init (ByteSet *set, const unsigned char *bits);
+const char *byte_set_span (const ByteSet *set, const char *pos,
+                           const char *end);
+const char *byte_set_find (const ByteSet *set, const char *pos,
+                           const char *end);
+
+typedef struct {
+    Inst          *insts;
+    unsigned int   ninsts;
+    unsigned int   start;
+    CharClass    **classes;
+    int            nclasses;
+    int            nloops;
+    Loop          *loops;
+    int           *inloop;
+    int            loopdepth;
+    int            ncalls;
+    Counter       *counters;
+    int            ncounters;
+    int            nasserts;
+    int            anchored;
+    int            nbytes;
+    unsigned char  bytemap[256];
+    int            nprefix;
+    char           prefix[PREFIX_MAX];
+    int            nfactors;
+    Factor         factors[FACTORS_MAX];
+    ByteSet       *sets;
+    ByteSet        first;
+    int            skip;
+    int            nmatches;
+    int            ncaptures;
+    int            debug;
+    size_t         stack_limit;
+} Prog;
+
+Prog       *prog_new         (Rx *rx);
+void        prog_free        (Prog *prog);
+void        prog_print       (Prog *prog);
+Prog       *prog_union       (Prog **progs, int *ids, int n);
+const char *prog_find_start  (Prog *prog, const char *pos, const char *end);
+int         prog_has_factors (Prog *prog, const char *str, size_t len);
+
+/* Calls and counters are more than the automata can keep track of, so
+programs with them are left to the backtracker.  */
+#define prog_backtrack_only(prog) ((prog)->ncalls || (prog)->ncounters)
+
+/* matcher  */
+typedef struct StackEntry StackEntry;
+
+typedef struct {
+    const char    **loops;
+    size_t          loopsize;
+    unsigned char  *visited;
+    size_t          visitedsize;
+    int            *calls;
+    size_t          callsize;
+    int            *callslot;
+    size_t          callslotsize;
+    unsigned int   *counts;
+    size_t          countsize;
+    int            *outer;
+    size_t          outersize;
+    unsigned long long *seen;
+    size_t          seensize;
+    StackEntry     *stack;
+    size_t          stacksize;
+} Backtrack;
+
+int  backtrack_match (Prog *prog, const char *str, size_t len,
+                      const char **beg, const char **end);
+int  backtrack_exec  (Prog *prog, const char *str, size_t len,
+                      const char **slots, int nslots, Backtrack *bt);
+void backtrack_free  (Backtrack *bt);
+
+/* pikevm  */
+typedef struct Pike Pike;
+
+Pike *pike_new    (Prog *prog);
+void  pike_free   (Pike *vm);
+int   pike_feed   (Pike *vm, const char *buf, size_t len);
+int   pike_finish (Pike *vm, size_t *beg, size_t *end);
+Pike *pike_grow   (Pike *vm, Prog *prog);
+void  pike_reset  (Pike *vm, Prog *prog);
+const size_t *pike_slots (Pike *vm);
+size_t pike_size  (Prog *prog);
+int   pike_match  (Prog *prog, const char *str, size_t len,
+                   const char **beg, const char **end);
+
+/* lazydfa  */
+typedef struct LazyDfa LazyDfa;
+
+#define DFA_DEFAULT_BUDGET (1 << 20)
+
+LazyDfa *lazy_dfa_new   (Prog *prog, size_t budget);
+void     lazy_dfa_free  (LazyDfa *dfa);
+int      lazy_dfa_match (LazyDfa *dfa, const char *str, size_t len);
+void     lazy_dfa_stats (LazyDfa *dfa, unsigned long *hits,
+                         unsigned long *misses, unsigned long *flushes);
+int      lazy_dfa_expand (LazyDfa *dfa, int max, unsigned int **table,
+                          unsigned char **eos);
+int      lazy_dfa_match_set (LazyDfa *dfa, const char *str, size_t len,
+                             char *matched);
+
+/* fulldfa  */
+typedef struct FullDfa FullDfa;
+
+FullDfa *full_dfa_new    (Prog *prog, int max);
+void     full_dfa_free   (FullDfa *dfa);
+int      full_dfa_states (FullDfa *dfa);
+size_t   full_dfa_size   (FullDfa *dfa);
+int      full_dfa_match  (FullDfa *dfa, const char *str, size_t len);
+size_t   full_dfa_save   (FullDfa *dfa, char *buf);
+FullDfa *full_dfa_load   (Prog *prog, const char *buf, size_t size,
+                          Arena *arena);
+
+/* scratch  */
+typedef struct {
+    Prog    *prog;
+    LazyDfa *dfa;
+} Fitted;
+
+struct RxScratch {
+    Pike         *pike;
+    Backtrack     backtrack;
+    const char  **slots;
+    size_t        slotsize;
+    char         *matched;
+    size_t        matchedsize;
+    Fitted       *fitted;
+    int           nfitted;
+    int           last;
+};
+
+Fitted    *scratch_fitted (RxScratch *scratch, Prog *prog);
+Fitted    *scratch_fit    (RxScratch *scratch, Prog *prog, int dfa,
+                           size_t budget);
+RxScratch *scratch_take   (RxScratch **spare);
+void       scratch_put    (RxScratch **spare, RxScratch *scratch);
+
 /* rx  */
 struct Rx {
     const char *regex;
-    List       *extends;
+    Arena      *arena;
+    Vec         extends;
     State      *start;
     State      *end;
-    List       *states;
-    List       *captures;
-    List       *clusters;
-    List       *subrules;
-    List       *charclasses;
-    List       *quantifications;
+    Vec         captures;
+    int         capture;
+    Vec         clusters;
+    Vec         subrules;
+    Prog       *prog;
+    size_t      dfa_cache;
+    FullDfa    *full;
+    RxScratch  *scratch;
+    int         loaded;
 };
 
 Rx *rx_extend (Rx *parent);
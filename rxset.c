@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+A set of regexes matched against a string together. Each regex is
+parsed and compiled on its own as usual, then rx_set_compile() joins
+their programs into one with prog_union(), and rx_set_match() runs the
+lazy DFA of that over the string once, however many regexes there are.
+
+Regexes that use <~~N> can't go in the union, so they are matched one
+at a time with rx_match(), as are all of them if the DFA gives up.
+
+Matching keeps what changes in an RxScratch fitted to the union and to
+every regex in the set, so once compiled, a set can be matched from any
+number of threads like a regex can. Adding to it and compiling it
+again can't be done while it's being matched.
+
+A state of the union's DFA can hold an instruction from every regex in
+the set, so unless told otherwise the DFA gets a budget of a kilobyte
+per instruction, when that is more than the usual default.
+*/
+
+#define SET_BUDGET_PER_INST 1024
+
+struct RxSet {
+    Rx       **rxs;
+    int        nrxs;
+    int        size;
+    RxOptions  options;
+    Prog      *prog;
+    size_t     budget;
+    int       *slow;
+    int        nslow;
+    int        compiled;
+    RxScratch *scratch;
+};
+
+RxSet *
+rx_set_new (const RxOptions *options) {
+    RxSet *set = calloc(1, sizeof (RxSet));
+    if (options)
+        set->options = *options;
+    return set;
+}
+
+static void
+rx_set_uncompile (RxSet *set) {
+    rx_scratch_free(set->scratch);
+    prog_free(set->prog);
+    free(set->slow);
+    set->scratch = NULL;
+    set->prog = NULL;
+    set->slow = NULL;
+    set->nslow = 0;
+    set->compiled = 0;
+}
+
+void
+rx_set_free (RxSet *set) {
+    int i;
+    rx_set_uncompile(set);
+    for (i = 0; i < set->nrxs; i++)
+        rx_free(set->rxs[i]);
+    free(set->rxs);
+    free(set);
+}
+
+/* Adds a regex to the set, returning its id, or -1 if it doesn't parse.
+The ids are given out from 0 in the order regexes are added. The set
+has to be compiled again before it's matched.  */
+int
+rx_set_add (RxSet *set, const char *regex) {
+    Rx *rx = rx_new_with(regex, &set->options);
+    if (!rx)
+        return -1;
+    rx_set_uncompile(set);
+    if (set->nrxs == set->size) {
+        set->size = set->size ? 2 * set->size : 16;
+        set->rxs = realloc(set->rxs, set->size * sizeof (Rx *));
+    }
+    set->rxs[set->nrxs] = rx;
+    return set->nrxs++;
+}
+
+void
+rx_set_compile (RxSet *set) {
+    Prog **progs;
+    size_t budget;
+    int *ids, i, n = 0;
+    rx_set_uncompile(set);
+    progs = malloc(set->nrxs * sizeof (Prog *));
+    ids = malloc(set->nrxs * sizeof (int));
+    set->slow = malloc(set->nrxs * sizeof (int));
+    for (i = 0; i < set->nrxs; i++) {
+        if (prog_backtrack_only(set->rxs[i]->prog)) {
+            set->slow[set->nslow++] = i;
+            continue;
+        }
+        progs[n] = set->rxs[i]->prog;
+        ids[n++] = i;
+    }
+    if (n) {
+        set->prog = prog_union(progs, ids, n);
+        budget = set->options.dfa_cache;
+        if (!budget && set->prog->ninsts > (1 << 20) / SET_BUDGET_PER_INST)
+            budget = set->prog->ninsts * (size_t) SET_BUDGET_PER_INST;
+        set->budget = budget;
+        if (set->options.debug)
+            prog_print(set->prog);
+    }
+    free(progs);
+    free(ids);
+    set->compiled = 1;
+    set->scratch = rx_set_scratch_new(set);
+}
+
+/* Makes a scratch that fits the set as it is compiled now. It has to be
+freed before the set is added to.  */
+RxScratch *
+rx_set_scratch_new (RxSet *set) {
+    RxScratch *scratch = calloc(1, sizeof (RxScratch));
+    int i;
+    if (set->prog)
+        scratch_fit(scratch, set->prog, 1, set->budget);
+    for (i = 0; i < set->nrxs; i++)
+        rx_scratch_fit(scratch, set->rxs[i]);
+    scratch->matched = grow(scratch->matched, &scratch->matchedsize,
+                            set->nrxs + 1);
+    return scratch;
+}
+
+/* Matches every regex in the set against the string. Returns how many
+matched, or -1 if the set wasn't compiled, and puts the ids of the
+first nids of them that matched in ids, in increasing order.  */
+int
+rx_set_match (RxSet *set, const char *str, int *ids, int nids) {
+    return rx_set_match_n(set, str, strlen(str), ids, nids);
+}
+
+/* The same for the len bytes at buf, like rx_match_n().  */
+int
+rx_set_match_n (RxSet *set, const char *buf, size_t len, int *ids, int nids) {
+    RxScratch *scratch;
+    int retval;
+    if (!set->compiled)
+        return -1;
+    if (!(scratch = scratch_take(&set->scratch)))
+        scratch = rx_set_scratch_new(set);
+    retval = rx_set_match_with(set, scratch, buf, len, ids, nids);
+    scratch_put(&set->scratch, scratch);
+    return retval;
+}
+
+/* The same, keeping what changes while matching in scratch, which has to
+have been made for the set by rx_set_scratch_new().  */
+int
+rx_set_match_with (RxSet *set, RxScratch *scratch, const char *buf,
+                   size_t len, int *ids, int nids) {
+    char *matched = scratch->matched;
+    Fitted *fitted;
+    int i, n = 0;
+    if (!set->compiled)
+        return -1;
+    memset(matched, 0, set->nrxs);
+    if (set->prog && prog_has_factors(set->prog, buf, len)) {
+        fitted = scratch_fitted(scratch, set->prog);
+        if (lazy_dfa_match_set(fitted->dfa, buf, len, matched) < 0) {
+            for (i = 0; i < set->nrxs; i++) {
+                if (!prog_backtrack_only(set->rxs[i]->prog))
+                    matched[i] = rx_match_with(set->rxs[i], scratch, buf, len,
+                                               NULL, 0) > 0;
+            }
+        }
+    }
+    for (i = 0; i < set->nslow; i++) {
+        matched[set->slow[i]] = rx_match_with(set->rxs[set->slow[i]], scratch,
+                                              buf, len, NULL, 0) > 0;
+    }
+    for (i = 0; i < set->nrxs; i++) {
+        if (!matched[i])
+            continue;
+        if (n < nids)
+            ids[n] = i;
+        n++;
+    }
+    return n;
+}
+
+void
+rx_set_stats (RxSet *set, RxStats *stats) {
+    RxScratch *scratch;
+    Fitted *fitted;
+    stats->dfa_hits = stats->dfa_misses = stats->dfa_flushes = 0;
+    if (!set->prog || !(scratch = scratch_take(&set->scratch)))
+        return;
+    fitted = scratch_fitted(scratch, set->prog);
+    lazy_dfa_stats(fitted->dfa, &stats->dfa_hits, &stats->dfa_misses,
+                   &stats->dfa_flushes);
+    scratch_put(&set->scratch, scratch);
+}
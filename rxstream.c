@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+Matching a string that arrives a piece at a time, without putting the
+pieces together first. The Pike VM is fed each piece as it comes, and
+carries its threads over from one piece to the next, so a match can
+begin in one piece and end in another, and its offsets count from the
+start of the whole string.
+
+Regexes that use <~~N> need the backtracker, which does have to see the
+whole string at once, so for those the pieces are copied into a buffer
+and matched when the stream is finished.
+*/
+
+struct RxStream {
+    Rx     *rx;
+    Pike   *vm;
+    char   *buf;
+    size_t  len;
+    size_t  size;
+    int     done;
+};
+
+RxStream *
+rx_stream_new (Rx *rx) {
+    RxStream *stream = calloc(1, sizeof (RxStream));
+    stream->rx = rx;
+    if (!prog_backtrack_only(rx->prog))
+        stream->vm = pike_new(rx->prog);
+    return stream;
+}
+
+void
+rx_stream_free (RxStream *stream) {
+    if (!stream)
+        return;
+    pike_free(stream->vm);
+    free(stream->buf);
+    free(stream);
+}
+
+/* Matches the next len bytes of the string. Returns 1 once the outcome
+no longer depends on what comes next, after which the rest of the string
+needn't be fed.  */
+int
+rx_stream_feed (RxStream *stream, const char *chunk, size_t len) {
+    if (stream->done)
+        return 1;
+    if (stream->vm)
+        return stream->done = pike_feed(stream->vm, chunk, len);
+    if (stream->len + len > stream->size) {
+        stream->size = stream->size ? 2 * stream->size : 4096;
+        while (stream->len + len > stream->size)
+            stream->size *= 2;
+        stream->buf = realloc(stream->buf, stream->size);
+    }
+    memcpy(stream->buf + stream->len, chunk, len);
+    stream->len += len;
+    return 0;
+}
+
+/* Ends the string. Returns whether the regex matched, and if so puts the
+offsets from the start of the string of where the match begins and ends
+in *beg and *end. Returns -1 if the backtracker ran out of stack.  */
+int
+rx_stream_finish (RxStream *stream, size_t *beg, size_t *end) {
+    const char *b, *e;
+    int retval;
+    stream->done = 1;
+    if (stream->vm)
+        return pike_finish(stream->vm, beg, end);
+    if ((retval = backtrack_match(stream->rx->prog, stream->buf, stream->len,
+                                  &b, &e)) <= 0)
+        return retval;
+    *beg = b - stream->buf;
+    *end = e - stream->buf;
+    return 1;
+}
@@ -4,29 +4,37 @@
 int
 main (int argc, char **argv) {
     char buffer[16384];
-    char *string;
     char *regex;
+    size_t n, beg, end;
     int retval;
+    RxStream *stream;
+    RxOptions options = {0};
     Rx *rx;
     if (argc != 2 && argc != 3) {
         fprintf(stderr, "usage: ./rxtry [string] regex\n");
         return 1;
     }
-    rx_debug = 1;
+    options.debug = 1;
+    regex = argv[argc - 1];
+    rx = rx_new_with(regex, &options);
+    if (!rx)
+        return 0;
     if (argc == 2) {
-        fread(buffer, 1, sizeof buffer, stdin);
-        string = buffer;
+        /* Stdin is matched as it's read, however long it is.  */
+        stream = rx_stream_new(rx);
+        while ((n = fread(buffer, 1, sizeof buffer, stdin)) &&
+               !rx_stream_feed(stream, buffer, n))
+            ;
+        retval = rx_stream_finish(stream, &beg, &end);
+        rx_stream_free(stream);
+        printf("match returned %d\n", retval);
+        if (retval)
+            printf("matched at %zu..%zu\n", beg, end);
     }
     else {
-        string = argv[1];
+        retval = rx_match(rx, argv[1]);
+        printf("match returned %d\n", retval);
     }
-    regex = argv[argc - 1];
-    rx = rx_new(regex);
-    if (!rx)
-        return 0;
-    retval = rx_match(rx, string);
-    printf("match returned %d\n", retval);
     rx_free(rx);
     return 0;
 }
-
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rxpriv.h"
+
+/*
+Everything that changes while a regex is matched, kept apart from the
+regex so that a caller matching over and over can hold on to it and not
+pay for setting it up each time. A scratch made for one regex can be
+fitted to more, after which it can match any of them, though only one
+at a time. The Pike VM and the backtracker's tables are shared, sized
+for the biggest of the regexes, while each program gets its own lazy
+DFA, since the states of one are no use to another.
+
+Once a scratch has warmed up, matching with it allocates nothing but
+new DFA states, until the DFA's cache is full, and backtracker tables
+for strings longer than any it has seen. A scratch has to be freed
+before the regexes it was fitted to.
+
+Regexes and sets keep a spare scratch of their own for rx_match() and
+the like. A thread takes it for the length of a match and puts it back
+after, with atomic exchanges, and a thread that finds it already taken
+makes a scratch of its own for the match. That leaves the regex itself
+unchanged by matching, so any number of threads can match it at once.
+*/
+
+RxScratch *
+rx_scratch_new (Rx *rx) {
+    RxScratch *scratch = calloc(1, sizeof (RxScratch));
+    rx_scratch_fit(scratch, rx);
+    return scratch;
+}
+
+/* Finds what the scratch holds for prog. Regexes tend to be matched in
+the order they were fitted, so the search starts after the last one
+found.  */
+Fitted *
+scratch_fitted (RxScratch *scratch, Prog *prog) {
+    int i, n = scratch->nfitted;
+    for (i = 0; i < n; i++) {
+        int k = (scratch->last + i) % n;
+        if (scratch->fitted[k].prog == prog) {
+            scratch->last = k + 1;
+            return &scratch->fitted[k];
+        }
+    }
+    return NULL;
+}
+
+/* Makes the scratch big enough to run prog, with a lazy DFA of the given
+budget if dfa is set.  */
+Fitted *
+scratch_fit (RxScratch *scratch, Prog *prog, int dfa, size_t budget) {
+    Fitted *fitted = scratch_fitted(scratch, prog);
+    if (fitted)
+        return fitted;
+    if (!prog_backtrack_only(prog))
+        scratch->pike = pike_grow(scratch->pike, prog);
+    scratch->slots = grow(scratch->slots, &scratch->slotsize,
+                          (2 + 2 * prog->ncaptures) * sizeof (const char *));
+    scratch->fitted = realloc(scratch->fitted,
+                              (scratch->nfitted + 1) * sizeof (Fitted));
+    fitted = &scratch->fitted[scratch->nfitted++];
+    fitted->prog = prog;
+    fitted->dfa = dfa ? lazy_dfa_new(prog, budget) : NULL;
+    return fitted;
+}
+
+/* Makes the scratch big enough to match rx too.  */
+void
+rx_scratch_fit (RxScratch *scratch, Rx *rx) {
+    scratch_fit(scratch, rx->prog,
+                !prog_backtrack_only(rx->prog) && !rx->full, rx->dfa_cache);
+}
+
+void
+rx_scratch_free (RxScratch *scratch) {
+    int i;
+    if (!scratch)
+        return;
+    for (i = 0; i < scratch->nfitted; i++)
+        lazy_dfa_free(scratch->fitted[i].dfa);
+    free(scratch->fitted);
+    pike_free(scratch->pike);
+    backtrack_free(&scratch->backtrack);
+    free(scratch->slots);
+    free(scratch->matched);
+    free(scratch);
+}
+
+/* Takes the spare scratch, or returns NULL if another thread has it.  */
+RxScratch *
+scratch_take (RxScratch **spare) {
+    return __atomic_exchange_n(spare, NULL, __ATOMIC_ACQUIRE);
+}
+
+/* Puts a scratch back as the spare, or frees it if another thread has
+put one back already.  */
+void
+scratch_put (RxScratch **spare, RxScratch *scratch) {
+    RxScratch *none = NULL;
+    if (!__atomic_compare_exchange_n(spare, &none, scratch, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        rx_scratch_free(scratch);
+}
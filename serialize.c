@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "rxpriv.h"
+
+/*
+A compiled regex saved as a blob of bytes, so that it can be loaded
+again without parsing or compiling it. Everything in the blob is found
+by its offset from the start, so it can be written to a file and mapped
+into memory at any address, by any number of processes at once.
+
+The blob is the program as the compiler laid it out: a header with the
+Prog struct and where each part is, then the regex, the instructions,
+the char classes, their byte sets, the bounds of counted loops, where
+the loops lie and the full DFA if there is one. rx_load() uses the
+instructions, byte sets, bounds, loops and DFA table where they lie.
+It only allocates the Rx and the Prog that point into the blob, and
+copies the char classes, since the program refers to them by pointer.
+The states and transitions the parser made aren't saved, so rx_print()
+has nothing to show for a loaded regex.
+
+Since the structs are saved as they are, a blob can only be loaded by a
+librx of the same BLOB_VERSION built for the same kind of machine. The
+header has the size of each struct and a number whose bytes give away
+the byte order, and rx_load() refuses a blob when any of those differ.
+Since blobs are meant to be mapped from files other programs share,
+rx_load() also checks every index in the program and the DFA table
+before using them, so that a corrupt blob is refused rather than sending
+an engine outside the blob. That takes time proportional to the size of
+the blob, which is still far less than compiling the regex again.
+*/
+
+#define BLOB_MAGIC "rxb"
+#define BLOB_VERSION 4
+#define BLOB_ALIGN 16
+#define BLOB_ORDER 0x01020304
+
+typedef struct {
+    char          magic[4];
+    unsigned int  version;
+    unsigned int  order;
+    unsigned int  sizes[4];
+    size_t        size;
+    size_t        dfa_cache;
+    size_t        regex;
+    size_t        insts;
+    size_t        classes;
+    size_t        sets;
+    size_t        counters;
+    size_t        loops;
+    size_t        inloop;
+    size_t        full;
+    size_t        nfull;
+    Prog          prog;
+} Blob;
+
+typedef struct {
+    size_t        str;
+    int           length;
+    unsigned char bits[32];
+} SavedClass;
+
+static void
+blob_header (Blob *blob) {
+    memcpy(blob->magic, BLOB_MAGIC, 4);
+    blob->version = BLOB_VERSION;
+    blob->order = BLOB_ORDER;
+    blob->sizes[0] = sizeof (void *);
+    blob->sizes[1] = sizeof (Inst);
+    blob->sizes[2] = sizeof (ByteSet);
+    blob->sizes[3] = sizeof (Blob);
+}
+
+/* Reserves n bytes at the end of the blob and returns their offset.  */
+static size_t
+reserve (size_t *pos, size_t n) {
+    size_t at = (*pos + BLOB_ALIGN - 1) & ~(size_t) (BLOB_ALIGN - 1);
+    *pos = at + n;
+    return at;
+}
+
+/* Saves the compiled regex in the size bytes at buf, and returns how
+many bytes it takes. If that's more than size, nothing is written, so
+calling it with a size of 0 tells how big a buffer to get. The buffer
+should be aligned like malloc() aligns it.  */
+size_t
+rx_serialize (Rx *rx, void *buf, size_t size) {
+    Prog *prog = rx->prog;
+    Blob blob;
+    SavedClass *saved;
+    CharClass *cc;
+    const char *beg, *end;
+    size_t pos = sizeof (Blob), len = strlen(rx->regex);
+    char *out = buf;
+    int i;
+    memset(&blob, 0, sizeof (Blob));
+    blob_header(&blob);
+    blob.regex = reserve(&pos, len + 1);
+    blob.insts = reserve(&pos, prog->ninsts * sizeof (Inst));
+    blob.sets = reserve(&pos, prog->nclasses * sizeof (ByteSet));
+    blob.classes = reserve(&pos, prog->nclasses * sizeof (SavedClass));
+    blob.counters = reserve(&pos, prog->ncounters * sizeof (Counter));
+    blob.loops = reserve(&pos, prog->nloops * sizeof (Loop));
+    blob.inloop = reserve(&pos, prog->ninsts * sizeof (int));
+    if (rx->full) {
+        blob.nfull = full_dfa_save(rx->full, NULL);
+        blob.full = reserve(&pos, blob.nfull);
+    }
+    blob.size = pos;
+    if (!out || pos > size)
+        return pos;
+
+    memset(out, 0, pos);
+    blob.dfa_cache = rx->dfa_cache;
+    blob.prog = *prog;
+    blob.prog.insts = NULL;
+    blob.prog.classes = NULL;
+    blob.prog.sets = NULL;
+    blob.prog.counters = NULL;
+    blob.prog.loops = NULL;
+    blob.prog.inloop = NULL;
+    blob.prog.debug = 0;
+    memcpy(out, &blob, sizeof (Blob));
+    memcpy(out + blob.regex, rx->regex, len + 1);
+    memcpy(out + blob.insts, prog->insts, prog->ninsts * sizeof (Inst));
+    if (prog->nclasses)
+        memcpy(out + blob.sets, prog->sets, prog->nclasses * sizeof (ByteSet));
+    if (prog->ncounters) {
+        memcpy(out + blob.counters, prog->counters,
+               prog->ncounters * sizeof (Counter));
+    }
+    if (prog->nloops)
+        memcpy(out + blob.loops, prog->loops, prog->nloops * sizeof (Loop));
+    memcpy(out + blob.inloop, prog->inloop, prog->ninsts * sizeof (int));
+    /* The text of a class is only for prog_print(), and is cut down to
+    the part of it in the regex.  */
+    saved = (SavedClass *) (out + blob.classes);
+    for (i = 0; i < prog->nclasses; i++) {
+        cc = prog->classes[i];
+        beg = cc->str < rx->regex ? rx->regex : cc->str;
+        end = cc->str + cc->length;
+        if (end > rx->regex + len)
+            end = rx->regex + len;
+        saved[i].str = blob.regex + (beg - rx->regex);
+        saved[i].length = end > beg ? end - beg : 0;
+        memcpy(saved[i].bits, cc->bits, 32);
+    }
+    if (rx->full)
+        full_dfa_save(rx->full, out + blob.full);
+    return pos;
+}
+
+static int
+in_blob (const Blob *blob, size_t offset, size_t n) {
+    return offset >= sizeof (Blob) && offset <= blob->size &&
+           n <= blob->size - offset;
+}
+
+/* Whether every instruction of the program goes on to an instruction of
+it, and refers to a class, loop, capture slot, counter and assertion it
+has, and the tables beside them are in bounds.  */
+static int
+valid_prog (const Prog *prog, size_t len) {
+    const Inst *inst;
+    unsigned int pc, n = prog->ninsts;
+    int i, calls = 0;
+    /* Every capture has its '(' in the regex, which is len long.  */
+    if (prog->nbytes < 1 || prog->nbytes > 256 || prog->ncaptures < 0 ||
+        prog->ncaptures > len ||
+        prog->nprefix < 0 || prog->nprefix > PREFIX_MAX ||
+        prog->nfactors < 0 || prog->nfactors > FACTORS_MAX ||
+        prog->loopdepth < 0 || prog->loopdepth > prog->nloops)
+        return 0;
+    for (i = 0; i < 256; i++) {
+        if (prog->bytemap[i] >= prog->nbytes)
+            return 0;
+    }
+    for (i = 0; i < prog->nfactors; i++) {
+        if (prog->factors[i].length < 1 ||
+            prog->factors[i].length > PREFIX_MAX)
+            return 0;
+    }
+    for (i = 0; i < prog->nloops; i++) {
+        if (prog->loops[i].outer < -1 || prog->loops[i].outer >= i ||
+            prog->loops[i].depth != (prog->loops[i].outer < 0 ? 1 :
+                                  prog->loops[prog->loops[i].outer].depth + 1))
+            return 0;
+    }
+    for (pc = 0; pc < n; pc++) {
+        inst = &prog->insts[pc];
+        if (prog->inloop[pc] < -1 || prog->inloop[pc] >= prog->nloops)
+            return 0;
+        switch (inst->op) {
+            case OP_MATCH:
+            case OP_RET:
+            case OP_FAIL:
+                continue;
+            case OP_FORK:
+                if (!inst->arg || inst->arg >= n - pc)
+                    return 0;
+                continue;
+            case OP_CHAR:
+            case OP_NCHAR:
+                if (inst->arg > 255)
+                    return 0;
+                break;
+            case OP_CLASS:
+                if (inst->arg >= prog->nclasses)
+                    return 0;
+                break;
+            case OP_ASSERT:
+                if (inst->arg >= ASSERT_MAX)
+                    return 0;
+                break;
+            case OP_CALL:
+                if (inst->arg >= n)
+                    return 0;
+                calls++;
+                break;
+            case OP_LOOP:
+                if (inst->arg >= prog->nloops ||
+                    prog->loops[inst->arg].depth > prog->loopdepth)
+                    return 0;
+                break;
+            case OP_PROGRESS:
+                if (inst->arg >= prog->nloops)
+                    return 0;
+                break;
+            case OP_SAVE:
+                if (inst->arg >= 2 * prog->ncaptures)
+                    return 0;
+                break;
+            case OP_REPEAT:
+                if (pc + 1 >= n)
+                    return 0;
+                /* fall through */
+            case OP_COUNT:
+                if (inst->arg >= prog->ncounters)
+                    return 0;
+                break;
+            case OP_JMP:
+            case OP_ANY:
+                break;
+            default:
+                return 0;
+        }
+        if (inst->out >= n)
+            return 0;
+    }
+    return !calls || prog->ncalls;
+}
+
+/* Makes a regex out of a blob rx_serialize() saved, which has to stay
+where it is until the regex is freed. Returns NULL if the blob is cut
+short, corrupt or was saved by an incompatible librx.  */
+Rx *
+rx_load (const void *ptr, size_t len) {
+    const char *buf = ptr;
+    const Blob *blob = ptr;
+    const SavedClass *saved;
+    Blob header;
+    Arena *arena;
+    Prog *prog;
+    Rx *rx;
+    int i;
+    if (len < sizeof (Blob) || (uintptr_t) ptr % BLOB_ALIGN)
+        return NULL;
+    blob_header(&header);
+    if (memcmp(blob->magic, header.magic, 4) ||
+        blob->version != header.version || blob->order != header.order ||
+        memcmp(blob->sizes, header.sizes, sizeof header.sizes) ||
+        blob->size > len)
+        return NULL;
+    if (!blob->prog.ninsts || blob->prog.start >= blob->prog.ninsts ||
+        blob->prog.nclasses < 0 || blob->prog.ncounters < 0 ||
+        blob->prog.nloops < 0 ||
+        !in_blob(blob, blob->regex, 1) ||
+        !in_blob(blob, blob->insts, blob->prog.ninsts * sizeof (Inst)) ||
+        !in_blob(blob, blob->sets, blob->prog.nclasses * sizeof (ByteSet)) ||
+        !in_blob(blob, blob->classes,
+                 blob->prog.nclasses * sizeof (SavedClass)) ||
+        !in_blob(blob, blob->counters,
+                 blob->prog.ncounters * sizeof (Counter)) ||
+        !in_blob(blob, blob->loops, blob->prog.nloops * sizeof (Loop)) ||
+        !in_blob(blob, blob->inloop, blob->prog.ninsts * sizeof (int)) ||
+        blob->full && !in_blob(blob, blob->full, blob->nfull))
+        return NULL;
+    if (!memchr(buf + blob->regex, 0, blob->size - blob->regex))
+        return NULL;
+    saved = (const SavedClass *) (buf + blob->classes);
+    for (i = 0; i < blob->prog.nclasses; i++) {
+        if (saved[i].length < 0 ||
+            !in_blob(blob, saved[i].str, saved[i].length))
+            return NULL;
+    }
+
+    arena = arena_new();
+    rx = arena_alloc(arena, sizeof (Rx));
+    rx->arena = arena;
+    rx->loaded = 1;
+    rx->regex = buf + blob->regex;
+    rx->dfa_cache = blob->dfa_cache;
+    rx->prog = prog = arena_alloc(arena, sizeof (Prog));
+    *prog = blob->prog;
+    prog->insts = (Inst *) (buf + blob->insts);
+    prog->sets = (ByteSet *) (buf + blob->sets);
+    prog->counters = (Counter *) (buf + blob->counters);
+    prog->loops = (Loop *) (buf + blob->loops);
+    prog->inloop = (int *) (buf + blob->inloop);
+    prog->debug = 0;
+    if (!valid_prog(prog, strlen(rx->regex))) {
+        arena_free(arena);
+        return NULL;
+    }
+    prog->classes = arena_alloc(arena, prog->nclasses * sizeof (CharClass *));
+    for (i = 0; i < prog->nclasses; i++) {
+        prog->classes[i] = arena_alloc(arena, sizeof (CharClass));
+        prog->classes[i]->str = buf + saved[i].str;
+        prog->classes[i]->length = saved[i].length;
+        memcpy(prog->classes[i]->bits, saved[i].bits, 32);
+    }
+    if (blob->full &&
+        !(rx->full = full_dfa_load(prog, buf + blob->full, blob->nfull,
+                                   arena))) {
+        arena_free(arena);
+        return NULL;
+    }
+    rx->scratch = rx_scratch_new(rx);
+    return rx;
+}
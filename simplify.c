@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "rxpriv.h"
+
+/*
+The parser builds the graph the easy way rather than the small way:
+every atom starts at a fresh state that the one before it reaches with
+an empty transition, every alternative ends with an empty transition
+to the state they all join at, and an assertion gets a state of its
+own. This pass takes those detours out before the graph is compiled.
+
+A state with no assertion and a single empty transition to a state of
+the same group matches exactly what that state matches, so whatever
+leads to it can lead straight to where it goes. Following a chain of
+them to its end gives the state that stands for all of them, and every
+transition, group return and group start is pointed there instead.
+States with no transitions at all are left alone, since what they do
+depends on where they are reached from: match, return from a call, or
+carry on after the group.
+
+Then two states of the same group with the same assertion and the same
+transitions, in the same order to the same places, match the same
+thing, so one of them can stand for both. Merging some can make others
+the same, so it goes round until nothing changes. This mostly shares
+the tails of alternatives, like the 'ing' of 'walking' | 'talking'.
+
+What the states stand for is kept in a map, and the backtransitions of
+a state that is gone are moved to the one that stands for it. At the
+end, backtransitions from states nothing reaches any more are dropped,
+so the graph reads the same both ways.
+*/
+
+typedef struct {
+    State **keys;
+    State **values;
+    int     n;
+    int     size;
+} StateMap;
+
+static int
+map_index (StateMap *map, State *key) {
+    int index = ((unsigned long) key >> 4) % map->size;
+    while (map->keys[index] && map->keys[index] != key)
+        index = (index + 1) % map->size;
+    return index;
+}
+
+static State *
+map_get (StateMap *map, State *key) {
+    int index;
+    if (!map->size)
+        return NULL;
+    index = map_index(map, key);
+    return map->keys[index] ? map->values[index] : NULL;
+}
+
+static void
+map_put (StateMap *map, State *key, State *value) {
+    StateMap old = *map;
+    int i, index;
+    if (map->size && map->keys[index = map_index(map, key)]) {
+        map->values[index] = value;
+        return;
+    }
+    if (2 * (map->n + 1) > map->size) {
+        map->size = old.size ? 2 * old.size : 64;
+        map->keys = calloc(map->size, sizeof (State *));
+        map->values = calloc(map->size, sizeof (State *));
+        map->n = 0;
+        for (i = 0; i < old.size; i++) {
+            if (old.keys[i])
+                map_put(map, old.keys[i], old.values[i]);
+        }
+        free(old.keys);
+        free(old.values);
+    }
+    index = map_index(map, key);
+    map->keys[index] = key;
+    map->values[index] = value;
+    map->n++;
+}
+
+static void
+map_free (StateMap *map) {
+    free(map->keys);
+    free(map->values);
+}
+
+typedef struct {
+    Rx       *root;
+    StateMap  stands;
+    StateMap  seen;
+    State   **states;
+    int       nstates;
+    int       size;
+} Simplifier;
+
+static Transition *
+only_empty (State *state) {
+    Transition *t;
+    if (state->assertfunc || state->transitions.n != 1)
+        return NULL;
+    t = state->transitions.items[0];
+    if (t->type || t->ret || !t->to || t->to == state ||
+        t->to->group != state->group)
+        return NULL;
+    return t;
+}
+
+/* Returns the state that stands for the given one, remembering it for
+every state of the chain that led there.  */
+static State *
+resolve (Simplifier *s, State *state) {
+    State *end = state, *next;
+    Transition *t;
+    if (!state)
+        return NULL;
+    while (1) {
+        if ((next = map_get(&s->stands, end)))
+            end = next;
+        else if ((t = only_empty(end)))
+            end = t->to;
+        else
+            break;
+    }
+    for (; state != end; state = next) {
+        if (!(next = map_get(&s->stands, state)))
+            next = ((Transition *) state->transitions.items[0])->to;
+        map_put(&s->stands, state, end);
+    }
+    return end;
+}
+
+static void
+add (Simplifier *s, State *state) {
+    if (!state || map_get(&s->seen, state))
+        return;
+    map_put(&s->seen, state, state);
+    if (s->nstates == s->size) {
+        s->size = s->size ? 2 * s->size : 64;
+        s->states = realloc(s->states, s->size * sizeof (State *));
+    }
+    s->states[s->nstates++] = state;
+}
+
+/* Lists the states reachable from the starts, pointing the transitions
+of each at the states that stand for their targets on the way.  */
+static void
+collect (Simplifier *s) {
+    Transition *t;
+    State *state;
+    int i, j;
+    for (i = 0; i < s->nstates; i++) {
+        state = s->states[i];
+        for (j = 0; j < state->transitions.n; j++) {
+            t = state->transitions.items[j];
+            t->to = resolve(s, t->to);
+            t->ret = resolve(s, t->ret);
+            add(s, t->to);
+            add(s, t->ret);
+        }
+    }
+}
+
+static void
+restart (Simplifier *s, Rx *rx) {
+    int i;
+    rx->start = resolve(s, rx->start);
+    rx->end = resolve(s, rx->end);
+    for (i = 0; i < rx->captures.n; i++)
+        restart(s, rx->captures.items[i]);
+    for (i = 0; i < rx->clusters.n; i++)
+        restart(s, rx->clusters.items[i]);
+}
+
+static void
+reachable (Simplifier *s) {
+    int i;
+    map_free(&s->seen);
+    s->seen.keys = s->seen.values = NULL;
+    s->seen.n = s->seen.size = 0;
+    s->nstates = 0;
+    restart(s, s->root);
+    add(s, s->root->start);
+    for (i = 0; i < s->root->captures.n; i++)
+        add(s, ((Rx *) s->root->captures.items[i])->start);
+    collect(s);
+}
+
+static unsigned long
+state_hash (State *state) {
+    unsigned long hash = (unsigned long) state->group ^
+                         (unsigned long) state->assertfunc;
+    Transition *t;
+    int i;
+    for (i = 0; i < state->transitions.n; i++) {
+        t = state->transitions.items[i];
+        hash = hash * 31 + ((unsigned long) t->to >> 4);
+        hash = hash * 31 + ((unsigned long) t->ret >> 4);
+        hash = hash * 31 + t->type;
+        hash = hash * 31 + (unsigned long) t->param;
+    }
+    return hash;
+}
+
+static int
+same_state (State *a, State *b) {
+    Transition *x, *y;
+    int i;
+    if (a->group != b->group || a->assertfunc != b->assertfunc ||
+        a->transitions.n != b->transitions.n)
+        return 0;
+    for (i = 0; i < a->transitions.n; i++) {
+        x = a->transitions.items[i];
+        y = b->transitions.items[i];
+        if (x->to != y->to || x->ret != y->ret || x->type != y->type ||
+            x->param != y->param)
+            return 0;
+    }
+    return 1;
+}
+
+/* Has one of each set of states that match the same thing stand for the
+others. Returns how many states are gone.  */
+static int
+merge (Simplifier *s) {
+    int size = 2 * s->nstates + 1, i, index, merged = 0;
+    State **table = calloc(size, sizeof (State *));
+    State *state;
+    for (i = 0; i < s->nstates; i++) {
+        state = s->states[i];
+        if (!state->transitions.n)
+            continue;
+        index = state_hash(state) % size;
+        while (table[index] && !same_state(table[index], state))
+            index = (index + 1) % size;
+        if (table[index]) {
+            map_put(&s->stands, state, table[index]);
+            merged++;
+        }
+        else
+            table[index] = state;
+    }
+    free(table);
+    return merged;
+}
+
+static int
+kept (Simplifier *s, State *state) {
+    return !state || map_get(&s->seen, state);
+}
+
+/* Moves the backtransitions of states that are gone to the states that
+stand for them, then drops the ones that come from states that are
+gone.  */
+static void
+backtransitions (Simplifier *s) {
+    State *state, *to;
+    Transition *t;
+    Vec *back;
+    int i, j, n;
+    for (i = 0; i < s->stands.size; i++) {
+        state = s->stands.keys[i];
+        if (!state || kept(s, state))
+            continue;
+        to = resolve(s, state);
+        for (j = 0; j < state->backtransitions.n; j++) {
+            vec_push(s->root->arena, &to->backtransitions,
+                     state->backtransitions.items[j]);
+        }
+        state->backtransitions.n = 0;
+    }
+    for (i = 0; i < s->nstates; i++) {
+        back = &s->states[i]->backtransitions;
+        for (j = 0, n = 0; j < back->n; j++) {
+            t = back->items[j];
+            if (kept(s, t->to) && kept(s, t->ret))
+                back->items[n++] = t;
+        }
+        back->n = n;
+    }
+}
+
+void
+rx_simplify (Rx *rx) {
+    Simplifier s = {0};
+    s.root = rx;
+    reachable(&s);
+    while (merge(&s))
+        reachable(&s);
+    backtransitions(&s);
+    map_free(&s.stands);
+    map_free(&s.seen);
+    free(s.states);
+}
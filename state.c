@@ -4,31 +4,26 @@
 
 Transition *
 transition_new (State *from, State *to, State *ret, int type, void *param) {
-    Transition *t = calloc(1, sizeof (Transition));
+    Transition *t = arena_alloc(from->group->arena, sizeof (Transition));
     t->to = to;
     t->ret = ret;
     t->type = type;
     t->param = param;
-    from->transitions = list_push(from->transitions, t);
+    vec_push(from->group->arena, &from->transitions, t);
     return t;
 }
 
 Transition *back_transition_new (State *from, State *to, State *ret,
                                  int type, void *param) {
-    Transition *t = calloc(1, sizeof (Transition));
+    Transition *t = arena_alloc(from->group->arena, sizeof (Transition));
     t->to = to;
     t->ret = ret;
     t->type = type;
     t->param = param;
-    from->backtransitions = list_push(from->backtransitions, t);
+    vec_push(from->group->arena, &from->backtransitions, t);
     return t;
 }
 
-void
-transition_free (Transition *t) {
-    free(t);
-}
-
 State *
 transition_state (State *a, State *b, int type, void *param) {
     if (!b)
@@ -47,16 +42,16 @@ transition_to_group (State *a, State *g, State *h, int type, void *param) {
 }
 
 static Quantified *
-quantified_new (Rx *rx, int min, int max) {
-    Quantified *q = calloc(1, sizeof (Quantified));
+quantified_new (Rx *rx, int min, int max, int frugal) {
+    Quantified *q = arena_alloc(rx->arena, sizeof (Quantified));
     q->min = min;
     q->max = max;
-    rx->quantifications = list_push(rx->quantifications, q);
+    q->frugal = frugal;
     return q;
 }
 
 void
-quantify (State **a, State **b, int min, int max) {
+quantify (State **a, State **b, int min, int max, int frugal) {
     State *g, *h;
     Quantified *q;
     if (min == 1 && max == 1)
@@ -64,14 +59,13 @@ quantify (State **a, State **b, int min, int max) {
     g = *a;
     h = *b;
     *a = state_new(g->group);
-    q = quantified_new(g->group, min, max);
+    q = quantified_new(g->group, min, max, frugal);
     *b = transition_to_group(*a, g, h, QUANTIFIED, q);
 }
 
 State *
 state_new (Rx *rx) {
-    State *state = calloc(1, sizeof (State));
-    rx->states = list_push(rx->states, state);
+    State *state = arena_alloc(rx->arena, sizeof (State));
     state->group = rx;
     return state;
 }
@@ -79,19 +73,13 @@ state_new (Rx *rx) {
 State *
 state_split (State *state) {
     State *next = state_new(state->group);
+    Vec none = {0};
     next->transitions = state->transitions;
-    state->transitions = NULL;
+    state->transitions = none;
     next->backtransitions = state->backtransitions;
-    state->backtransitions = NULL;
+    state->backtransitions = none;
     next->assertfunc = state->assertfunc;
     state->assertfunc = NULL;
     return next;
 }
 
-void
-state_free (State *state) {
-    list_free(state->transitions, transition_free);
-    list_free(state->backtransitions, transition_free);
-    free(state);
-}
-
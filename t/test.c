@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "tap.h"
 #include "../rxpriv.h"
 
@@ -12,23 +15,876 @@ rx_like_at_loc (int for_match, const char *file, int line, const char *got,
                 const char *expected, const char *fmt, ...)
 {
     va_list args;
+    const char *beg, *end;
+    int test, agree;
+    RxOptions raw = {0};
+    FullDfa *full;
+    Rx *rx;
+    raw.no_simplify = 1;
+    if (!(rx = rx_new_with(expected, &raw)))
+        exit(255);
+    test = rx_match(rx, got);
+    rx_free(rx);
+    rx = rx_new(expected);
+    agree = rx_match(rx, got) == test;
+    if (!prog_backtrack_only(rx->prog))
+        agree = agree &&
+                pike_match(rx->prog, got, strlen(got), &beg, &end) == test;
+    if ((full = full_dfa_new(rx->prog, 10000))) {
+        agree = agree && full_dfa_match(full, got, strlen(got)) == test;
+        full_dfa_free(full);
+    }
+    test = agree && test ^ !for_match;
+    rx_free(rx);
+    va_start(args, fmt);
+    vok_at_loc(file, line, test, fmt, args);
+    va_end(args);
+    if (!agree) {
+        diag("    the engines disagree on whether '%s' matches '%s'",
+            expected, got);
+    }
+    else if (!test) {
+        diag("    %13s  '%s'", "", got);
+        diag("    %13s: '%s'",
+            for_match ? "doesn't match" : "matches", expected);
+    }
+    return test;
+}
+
+#define rx_match_is(...) rx_match_is_at_loc(__FILE__, __LINE__, __VA_ARGS__, NULL)
+
+/* Checks that every engine that can run the regex finds the same,
+expected, part of the string.  */
+int
+rx_match_is_at_loc (const char *file, int line, const char *got,
+                    const char *expected, const char *match,
+                    const char *fmt, ...)
+{
+    va_list args;
+    const char *beg, *end;
+    char *bmatch = NULL, *pmatch = NULL;
     int test;
     Rx *rx = rx_new(expected);
     if (!rx)
         exit(255);
-    test = rx_match(rx, got) ^ !for_match;
+    if (backtrack_match(rx->prog, got, strlen(got), &beg, &end))
+        bmatch = strdupf("%.*s", (int) (end - beg), beg);
+    if (!prog_backtrack_only(rx->prog) &&
+        pike_match(rx->prog, got, strlen(got), &beg, &end))
+        pmatch = strdupf("%.*s", (int) (end - beg), beg);
+    else if (prog_backtrack_only(rx->prog) && bmatch)
+        pmatch = strdupf("%s", bmatch);
+    test = bmatch && pmatch && !strcmp(bmatch, match) && !strcmp(pmatch, match);
     rx_free(rx);
     va_start(args, fmt);
     vok_at_loc(file, line, test, fmt, args);
     va_end(args);
     if (!test) {
-        diag("    %13s  '%s'", "", got);
-        diag("    %13s: '%s'",
-            for_match ? "doesn't match" : "matches", expected);
+        diag("    %13s: '%s'", "regex", expected);
+        diag("    %13s: '%s'", "expected", match);
+        diag("    %13s: '%s'", "backtracker", bmatch ? bmatch : "(none)");
+        diag("    %13s: '%s'", "pike vm", pmatch ? pmatch : "(none)");
     }
+    free(bmatch);
+    free(pmatch);
+    return test;
+}
+
+/* Matches a regex that needs more DFA states than fit in a small cache,
+checking the answer is still right and the cache was flushed.  */
+void
+dfa_cache_thrash (void) {
+    RxOptions options = {0};
+    RxStats stats;
+    char str[4096];
+    unsigned int seed = 1;
+    int i, n = sizeof str - 13;
+    Rx *rx;
+    for (i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        str[i] = seed >> 16 & 1 ? 'a' : 'b';
+    }
+    strcpy(str + n, "abababababx");
+    options.dfa_cache = 16384;
+    rx = rx_new_with("a <[ab]> ** 9 x", &options);
+    ok(rx_match(rx, str), "match with a small dfa cache");
+    str[n + 10] = 'y';
+    ok(!rx_match(rx, str), "fail match with a small dfa cache");
+    rx_stats(rx, &stats);
+    cmp_ok(stats.dfa_misses, ">", 0, "dfa cache misses are counted");
+    cmp_ok(stats.dfa_flushes, ">", 0, "dfa cache flushes are counted");
+    rx_free(rx);
+    options.dfa_cache = 16;
+    rx = rx_new_with("a <[ab]> ** 9 y", &options);
+    ok(rx_match(rx, str), "match with no room for the dfa");
+    rx_free(rx);
+    rx = rx_new("<alpha>+ \\d");
+    rx_match(rx, "abcdefgh1");
+    rx_match(rx, "abcdefgh1");
+    rx_stats(rx, &stats);
+    cmp_ok(stats.dfa_hits, ">=", 9, "dfa cache hits are counted");
+    rx_free(rx);
+}
+
+/* Builds full DFAs, checking that equivalent states are merged and that
+a regex with too many states falls back to the other engines.  */
+void
+full_dfa (void) {
+    RxOptions options = {0};
+    Rx *rx;
+    options.full_dfa = 1;
+    rx = rx_new_with("[a | b]* c", &options);
+    ok(rx->full != NULL, "full dfa built");
+    cmp_ok(full_dfa_states(rx->full), "==", 3, "full dfa minimized");
+    ok(rx_match(rx, "ababc"), "full dfa match");
+    ok(!rx_match(rx, "abab"), "full dfa fail match");
+    rx_free(rx);
+    rx = rx_new_with("[ab | a b]+ $", &options);
+    cmp_ok(full_dfa_states(rx->full), "==", 5, "full dfa merges alternatives");
+    ok(rx_match(rx, "xabab"), "full dfa match at end");
+    ok(!rx_match(rx, "ababx"), "full dfa fail match at end");
+    rx_free(rx);
+    options.full_dfa_states = 64;
+    rx = rx_new_with("a <[ab]> ** 9 x", &options);
+    ok(rx->full == NULL && scratch_fitted(rx->scratch, rx->prog)->dfa, "full dfa state limit");
+    ok(rx_match(rx, "bbabbbbbbbbbx"), "match past full dfa state limit");
+    rx_free(rx);
+}
+
+/* Checks the literal prefix found for a few regexes, and matches that
+have to skip ahead to it.  */
+void
+literal_prefix (void) {
+    Rx *rx = rx_new("'GET ' \\S+");
+    cmp_ok(rx->prog->nprefix, "==", 4, "literal prefix length");
+    ok(!strncmp(rx->prog->prefix, "GET ", 4), "literal prefix");
+    rx_free(rx);
+    rx = rx_new("a | ab");
+    cmp_ok(rx->prog->nprefix, "==", 0, "no prefix across alternatives");
+    rx_free(rx);
+    rx_match_is ("PUT /a GET /b", "'GET ' \\S+", "GET /b", "skip to prefix");
+    rx_match_is ("GE GET", "'GET'", "GET", "skip over partial prefix");
+    rx_match_is ("xxabyab ", "ab \\b", "ab", "assertion after prefix");
+    rx_like   ("xxxaxxxab", "a b", "skip to one char prefix");
+    rx_unlike ("xxxaxxxa", "a b", "fail to find prefix");
+    rx_unlike ("xab", "^ a b", "anchored prefix");
+}
+
+/* Checks the factors found for a few regexes, and that strings without
+them are rejected.  */
+void
+required_factors (void) {
+    Rx *rx = rx_new("<digit>+ 'ms' \\s");
+    cmp_ok(rx->prog->nfactors, "==", 1, "one required factor");
+    ok(!strncmp(rx->prog->factors[0].str, "ms", 2), "required factor");
+    ok(rx_match(rx, "took 25ms to run"), "match with required factor");
+    ok(!rx_match(rx, "took 25 to run"), "reject without required factor");
+    ok(!rx_match(rx, "ms took 25 to run"), "fail with required factor");
+    rx_free(rx);
+    rx = rx_new("[x | y] abc [d | e] fg");
+    cmp_ok(rx->prog->nfactors, "==", 2, "two required factors");
+    ok(!strncmp(rx->prog->factors[0].str, "abc", 3), "longest factor first");
+    ok(!rx_match(rx, "xabce fx"), "reject without second factor");
+    rx_free(rx);
+    rx = rx_new("[a b | c]* d");
+    cmp_ok(rx->prog->nfactors, "==", 1, "no factor inside a loop");
+    rx_free(rx);
+}
+
+/* Checks byte_set_span() and byte_set_find() against a byte at a time
+for sets of one range, a few ranges and many, from every alignment and
+to ends at every alignment.  */
+void
+byte_sets (void) {
+    static const char *classes[] = {"\\d", "<alnum>", "<[aeiou%]>", "\\S"};
+    char str[200];
+    const char *span, *find, *pos, *end;
+    ByteSet set;
+    Rx *rx;
+    int i, j, k, bad;
+    for (i = 0; i < 4; i++) {
+        rx = rx_new(classes[i]);
+        byte_set_init(&set, rx->prog->classes[0]->bits);
+        for (bad = 0, j = 0; j < 100; j++) {
+            for (k = 0; k < (int) sizeof str - 1; k++)
+                str[k] = k < j || k > j + 70 ? 'x' : "a1%\xe9 q9\0u"[k % 10];
+            for (k = 0; k < 40; k++) {
+                end = str + j + k + k * 7 % 60;
+                span = byte_set_span(&set, str + j + k, end);
+                find = byte_set_find(&set, str + j + k, end);
+                for (pos = str + j + k; pos < end &&
+                     char_class_match(rx->prog->classes[0], *pos); pos++)
+                    ;
+                bad += span != pos;
+                for (pos = str + j + k; pos < end &&
+                     !char_class_match(rx->prog->classes[0], *pos); pos++)
+                    ;
+                bad += find != (pos < end ? pos : NULL);
+            }
+        }
+        ok(!bad, "byte set scan %s", classes[i]);
+        rx_free(rx);
+    }
+}
+
+/* Matches runs long enough that the backtracker has no bitmap, and so
+finds their ends with byte_set_span().  */
+void
+long_runs (void) {
+    size_t n = 1 << 20;
+    char *str = malloc(n + 3);
+    char *match;
+    const char *beg, *end;
+    Rx *rx;
+    memset(str, 'a', n);
+    strcpy(str + n, "1b");
+    rx = rx_new("<alpha>* \\d");
+    ok(backtrack_match(rx->prog, str, n + 2, &beg, &end) && beg == str &&
+       end == str + n + 1, "long greedy class run");
+    rx_free(rx);
+    rx = rx_new(".* a");
+    ok(backtrack_match(rx->prog, str, n + 2, &beg, &end) && end == str + n,
+       "long greedy any run backtracks");
+    rx_free(rx);
+    rx = rx_new("<-[b]>*? 1");
+    ok(backtrack_match(rx->prog, str, n + 2, &beg, &end) && end == str + n + 1,
+       "long frugal class run");
+    rx_free(rx);
+    str[n / 2] = 'b';
+    match = str + n / 2 + 1;
+    rx = rx_new("b a* 1");
+    ok(backtrack_match(rx->prog, str, n + 2, &beg, &end) && beg == match - 1 &&
+       end == str + n + 1, "long char run");
+    rx_free(rx);
+    free(str);
+}
+
+/* Checks that a set finds the same regexes as matching them one by one,
+with the DFA and with the cache too small for it.  */
+void
+rx_set (void) {
+    static const char *regexes[] = {
+        "foo", "^ bar", "baz $", "<digit>+ 'ms'", "(a) b <~~0>", "x*",
+        "\\w+ '=' \\d", "<< o", "o >>"
+    };
+    static const char *strs[] = {
+        "foo", "bar foo", "foo bar", "took 20ms", "abaz", "baz.", "n=4",
+        "", "oops", "zoo", "bar"
+    };
+    RxOptions options = {0};
+    RxSet *set;
+    Rx *rx;
+    char str[64];
+    int ids[16], i, j, k, n, in, bad;
+    for (k = 0; k < 2; k++) {
+        options.dfa_cache = k ? 16 : 0;
+        set = rx_set_new(&options);
+        for (i = 0; i < 9; i++)
+            rx_set_add(set, regexes[i]);
+        rx_set_compile(set);
+        for (bad = 0, i = 0; i < 11; i++) {
+            n = rx_set_match(set, strs[i], ids, 16);
+            for (j = 0; j < 9; j++) {
+                rx = rx_new(regexes[j]);
+                for (in = 0; in < n && ids[in] != j; in++)
+                    ;
+                bad += (in < n) != rx_match(rx, strs[i]);
+                rx_free(rx);
+            }
+        }
+        ok(!bad, "set matches like its regexes%s", k ? " without a dfa" : "");
+        rx_set_free(set);
+    }
+    /* "a ?" has an OP_MATCH after the a and another for leaving it out,
+    and matching it mustn't stop the scan before "a b" can match.  */
+    set = rx_set_new(NULL);
+    rx_set_add(set, "a b");
+    rx_set_add(set, "a ?");
+    rx_set_compile(set);
+    ok(rx_set_match(set, "cab", ids, 16) == 2 && ids[0] == 0 && ids[1] == 1,
+       "set matches a regex after one with several ends");
+    rx_set_free(set);
+    set = rx_set_new(NULL);
+    for (i = 0; i < 300; i++) {
+        sprintf(str, "w%d x", i);
+        rx_set_add(set, str);
+    }
+    ok(rx_set_add(set, "(") < 0, "set rejects bad regex");
+    cmp_ok(rx_set_match(set, "w1x", ids, 16), "==", -1, "set not compiled");
+    rx_set_compile(set);
+    n = rx_set_match(set, "w17x w250x w3", ids, 1);
+    cmp_ok(n, "==", 2, "set of many regexes");
+    cmp_ok(ids[0], "==", 17, "set ids");
+    cmp_ok(rx_set_match(set, "w17", ids, 16), "==", 0, "set without match");
+    rx_set_free(set);
+}
+
+/* Matches len bytes of buf with every engine that can run the regex,
+returning whether they match, or -1 if the engines disagree.  */
+int
+match_n (const char *regex, const char *buf, size_t len) {
+    const char *beg, *end;
+    FullDfa *full;
+    Rx *rx = rx_new(regex);
+    int test = rx_match_n(rx, buf, len);
+    if (backtrack_match(rx->prog, buf, len, &beg, &end) != test)
+        test = -1;
+    if (!prog_backtrack_only(rx->prog) &&
+        pike_match(rx->prog, buf, len, &beg, &end) != test)
+        test = -1;
+    if ((full = full_dfa_new(rx->prog, 10000))) {
+        if (full_dfa_match(full, buf, len) != test)
+            test = -1;
+        full_dfa_free(full);
+    }
+    rx_free(rx);
     return test;
 }
 
+/* Matches buffers with NULs in them and buffers that don't end in one,
+which ASan checks aren't read past their length.  */
+void
+binary_strings (void) {
+    char *buf = malloc(4);
+    RxSet *set;
+    int ids[4];
+    memcpy(buf, "abc$", 4);
+    cmp_ok(match_n("a . b", "a\0b", 3), "==", 1, "any char matches NUL");
+    cmp_ok(match_n("<-[x]>+ y", "\0\0\0y", 4), "==", 1,
+           "negated class run over NULs");
+    cmp_ok(match_n("\\w+ $", "ab\0", 3), "==", 0, "NUL isn't a word char");
+    cmp_ok(match_n("a $", "xa\0yz", 2), "==", 1, "end of string is the length");
+    cmp_ok(match_n("a $", "xa\0yz", 5), "==", 0, "NUL isn't the end of string");
+    cmp_ok(match_n("c >>", buf, 3), "==", 1, "word boundary at the length");
+    cmp_ok(match_n("'c$'", buf, 3), "==", 0, "prefix past the length");
+    cmp_ok(match_n("[b | c]+ '$'", buf, 4), "==", 1, "unterminated buffer");
+    cmp_ok(match_n("(a) . <~~0>", "a\0a", 3), "==", 1, "NUL in a call");
+    set = rx_set_new(NULL);
+    rx_set_add(set, "a $");
+    rx_set_add(set, "b a");
+    rx_set_add(set, "'$'");
+    rx_set_compile(set);
+    cmp_ok(rx_set_match_n(set, buf, 3, ids, 4), "==", 0, "set with a length");
+    cmp_ok(rx_set_match_n(set, "ba\0a", 2, ids, 4), "==", 2,
+           "set end of string is the length");
+    rx_set_free(set);
+    free(buf);
+}
+
+/* Feeds strings to a stream in pieces of every size and checks that it
+finds the same match as matching the whole string.  */
+void
+streams (void) {
+    static const char *regexes[] = {
+        "'GET ' \\S+", "o \\b", "^^ b", "a+ $$", "<-[x]>+? y", "(a) b <~~0>",
+        "^ x", "l+"
+    };
+    const char *str = "GET /a\nbaab GET /oops\naba aaa\nxy";
+    const char *beg, *end;
+    size_t len = strlen(str), b, e, i, k;
+    RxStream *stream;
+    Rx *rx;
+    int j, bad, retval;
+    for (bad = 0, j = 0; j < 8; j++) {
+        rx = rx_new(regexes[j]);
+        retval = backtrack_match(rx->prog, str, len, &beg, &end);
+        for (k = 1; k <= len; k++) {
+            stream = rx_stream_new(rx);
+            for (i = 0; i < len; i += k) {
+                if (rx_stream_feed(stream, str + i, i + k < len ? k : len - i))
+                    break;
+            }
+            bad += rx_stream_finish(stream, &b, &e) != retval ||
+                   retval && (b != beg - str || e != end - str);
+            rx_stream_free(stream);
+        }
+        rx_free(rx);
+    }
+    ok(!bad, "streams match across pieces");
+    rx = rx_new("a+ $");
+    stream = rx_stream_new(rx);
+    rx_stream_feed(stream, "xaa", 3);
+    rx_stream_feed(stream, "", 0);
+    rx_stream_feed(stream, "aa", 2);
+    ok(rx_stream_finish(stream, &b, &e) && b == 1 && e == 5,
+       "stream match spans pieces");
+    rx_stream_free(stream);
+    stream = rx_stream_new(rx);
+    rx_stream_feed(stream, "aa", 2);
+    rx_stream_feed(stream, "b", 1);
+    ok(!rx_stream_finish(stream, &b, &e), "stream end of string");
+    rx_stream_free(stream);
+    rx_free(rx);
+}
+
+/* Runs rx_exec() and describes the spans it fills in, checking that the
+backtracker finds the same ones.  */
+char *
+exec_spans (const char *regex, const char *str, const RxOptions *options) {
+    RxSpan spans[4];
+    const char *slots[8];
+    char *desc = NULL, *old;
+    size_t len = strlen(str);
+    int i, bad = 0;
+    Rx *rx = rx_new_with(regex, options);
+    if (!rx_exec(rx, str, len, spans, 4)) {
+        rx_free(rx);
+        return strdupf("no match");
+    }
+    if (!backtrack_exec(rx->prog, str, len, slots, 8, NULL))
+        bad = 1;
+    for (i = 0; i < 4; i++) {
+        if (slots[2 * i] ? spans[i].beg != slots[2 * i] - str ||
+                           spans[i].end != slots[2 * i + 1] - str
+                         : spans[i].beg != -1)
+            bad = 1;
+        old = desc;
+        desc = strdupf("%s%s%d..%d", old ? old : "", old ? " " : "",
+                       (int) spans[i].beg, (int) spans[i].end);
+        free(old);
+    }
+    rx_free(rx);
+    if (bad) {
+        free(desc);
+        return strdupf("the engines disagree");
+    }
+    return desc;
+}
+
+void
+captures (void) {
+    RxOptions options = {0};
+    RxSpan spans[2] = {{7, 7}, {7, 7}};
+    char *desc;
+    Rx *rx;
+    static const char *tests[][4] = {
+        {"(\\d+) '-' (\\d+)", "tel 12-345", "4..10 4..6 7..10 -1..-1",
+         "groups"},
+        {"(a) | (b)", "b", "0..1 -1..-1 0..1 -1..-1",
+         "group not gone through"},
+        {"(<alpha>)+", "abc", "0..3 2..3 -1..-1 -1..-1",
+         "last time round a loop"},
+        {"(a?)* b", "aab", "0..3 1..2 -1..-1 -1..-1",
+         "loop that can match nothing"},
+        {"((a) b) (c)", "abc", "0..3 0..2 2..3 -1..-1",
+         "groups in groups aren't numbered"},
+        {"[(a) | a b] c", "abc", "0..3 -1..-1 -1..-1 -1..-1",
+         "group undone by backtracking"},
+        {"(a+) <~~0>", "aaaa", "0..4 0..3 -1..-1 -1..-1",
+         "groups with calls"},
+        {"x (a)", "aaa", "no match", "no match"},
+    };
+    /* A call nothing goes through leaves the regex to the backtracker,
+    which has to find the same spans as the Pike VM does without it.  */
+    static const char *twins[][3] = {
+        {"[a*?]* (x?)", "[a*?]* (x?) [z <~~>]?", "aa"},
+        {"[a *? (b*)]*", "[a *? (b*)]* [z <~~>]?", "aab"},
+        {"[(a*?) <-[a]> *]* (N?)", "[(a*?) <-[a]> *]* (N?) [z <~~>]?", "aaN"},
+        {"(a?)* b", "(a?)* b [z <~~>]?", "aab"},
+    };
+    char *twin;
+    int i;
+    for (i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+        desc = exec_spans(tests[i][0], tests[i][1], NULL);
+        is(desc, tests[i][2], "captures %s", tests[i][3]);
+        free(desc);
+    }
+    for (i = 0; i < sizeof twins / sizeof twins[0]; i++) {
+        desc = exec_spans(twins[i][0], twins[i][2], NULL);
+        twin = exec_spans(twins[i][1], twins[i][2], NULL);
+        is(desc, twin, "captures of '%s' with and without a call",
+           twins[i][0]);
+        free(desc);
+        free(twin);
+    }
+    options.full_dfa = 1;
+    desc = exec_spans("(\\w+) '=' (\\w+)", "k=v; key=value", &options);
+    is(desc, "0..3 0..1 2..3 -1..-1", "captures with a full dfa");
+    free(desc);
+    rx = rx_new("a (b)");
+    ok(!rx_exec(rx, "ac", 2, spans, 2) && spans[0].beg == -1 &&
+       spans[1].end == -1, "spans reset without a match");
+    ok(rx_exec(rx, "xab", 3, spans, 1) && spans[0].beg == 1 &&
+       spans[0].end == 3, "fewer spans than groups");
+    rx_free(rx);
+}
+
+/* Shares one scratch between regexes of different sizes, some with
+calls and some with groups, and checks it finds what each regex's own
+scratch does.  */
+void
+scratch (void) {
+    static const char *regexes[] = {
+        "b", "(\\w+) '=' (\\w+)", "(a+) <~~0>", "[x | y | z]+ (\\d)",
+        "((a) b)* (c)"
+    };
+    static const char *strs[] = {
+        "k=v", "aaaa", "xyz1", "ababc", "b", "", "zz"
+    };
+    RxSpan spans[3], expected[3];
+    RxScratch *scratch;
+    Rx *rxs[5];
+    int i, j, k, bad = 0;
+    for (i = 0; i < 5; i++)
+        rxs[i] = rx_new(regexes[i]);
+    scratch = rx_scratch_new(rxs[0]);
+    for (i = 1; i < 4; i++)
+        rx_scratch_fit(scratch, rxs[i]);
+    for (k = 0; k < 3; k++) {
+        for (i = 0; i < 5; i++) {
+            for (j = 0; j < 7; j++) {
+                size_t len = strlen(strs[j]);
+                bad += rx_match_with(rxs[i], scratch, strs[j], len, spans, 3) !=
+                       rx_exec(rxs[i], strs[j], len, expected, 3) ||
+                       memcmp(spans, expected, sizeof spans) ||
+                       rx_match_with(rxs[i], scratch, strs[j], len, NULL, 0) !=
+                       rx_match_n(rxs[i], strs[j], len);
+            }
+        }
+    }
+    ok(!bad, "scratch shared between regexes");
+    ok(scratch_fitted(scratch, rxs[4]->prog) != NULL,
+       "scratch fitted to a regex on first use");
+    rx_scratch_free(scratch);
+    for (i = 0; i < 5; i++)
+        rx_free(rxs[i]);
+}
+
+/* Gets regexes of about the same size from a cache with room for two of
+them, and checks the least recently gotten one is the one that goes.  */
+void
+cache (void) {
+    RxCacheStats stats;
+    RxCache *cache = rx_cache_new((size_t) -1);
+    Rx *a, *b;
+    a = rx_cache_get(cache, "'aaaa' \\d");
+    b = rx_cache_get(cache, "'aaaa' \\d");
+    ok(a && a == b && rx_match(a, "aaaa1"), "cache gets the same regex");
+    ok(!rx_cache_get(cache, "("), "cache doesn't keep a bad regex");
+    rx_cache_stats(cache, &stats);
+    ok(stats.hits == 1 && stats.misses == 2 && stats.regexes == 1,
+       "cache counts hits and misses");
+    ok(stats.bytes > 1 << 20, "cache counts the lazy dfa budget");
+    rx_cache_release(cache, a);
+    rx_cache_release(cache, b);
+    rx_cache_free(cache);
+
+    cache = rx_cache_new(stats.bytes * 5 / 2);
+    rx_cache_release(cache, rx_cache_get(cache, "'aaaa' \\d"));
+    rx_cache_release(cache, rx_cache_get(cache, "'bbbb' \\d"));
+    rx_cache_release(cache, rx_cache_get(cache, "'aaaa' \\d"));
+    rx_cache_release(cache, rx_cache_get(cache, "'cccc' \\d"));
+    rx_cache_stats(cache, &stats);
+    ok(stats.regexes == 2 && stats.evictions == 1, "cache evicts to fit");
+    rx_cache_release(cache, rx_cache_get(cache, "'aaaa' \\d"));
+    rx_cache_release(cache, rx_cache_get(cache, "'cccc' \\d"));
+    rx_cache_stats(cache, &stats);
+    ok(stats.hits == 3 && stats.misses == 3,
+       "cache evicts the least recently used");
+    a = rx_cache_get(cache, "'dddd' \\d");
+    b = rx_cache_get(cache, "'eeee' \\d");
+    rx_cache_release(cache, rx_cache_get(cache, "'ffff' \\d"));
+    rx_cache_stats(cache, &stats);
+    ok(stats.regexes == 2 && rx_match(a, "dddd2") && rx_match(b, "eeee3"),
+       "cache keeps regexes that are held");
+    rx_cache_release(cache, a);
+    rx_cache_release(cache, b);
+    rx_cache_free(cache);
+}
+
+/* Counts the states reachable from the start of a regex, and how many
+of the transitions between them plain or into a group have no
+backtransition to go with them.  */
+int
+count_states (Rx *rx, int *unmatched) {
+    State *states[256];
+    Transition *t, *b;
+    State *mirror;
+    int n = 0, i, j, k, found;
+    states[n++] = rx->start;
+    *unmatched = 0;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < states[i]->transitions.n; j++) {
+            t = states[i]->transitions.items[j];
+            mirror = t->ret ? t->ret : t->to;
+            for (k = 0, found = 0; mirror && k < mirror->backtransitions.n; k++) {
+                b = mirror->backtransitions.items[k];
+                found |= t->ret ? b->ret == states[i] : b->to == states[i];
+            }
+            *unmatched += mirror && !found;
+            for (k = 0; k < n && states[k] != t->to; k++)
+                ;
+            if (t->to && k == n && n < 256)
+                states[n++] = t->to;
+            for (k = 0; k < n && states[k] != t->ret; k++)
+                ;
+            if (t->ret && k == n && n < 256)
+                states[n++] = t->ret;
+        }
+    }
+    return n;
+}
+
+/* Checks the graph gets smaller, and the backtransitions still mirror
+the transitions.  */
+void
+simplify (void) {
+    static const char *regexes[] = {
+        "'walking' | 'talking'", "(\\d+) '.' (\\d+) ' ' <alpha>+",
+        "^ [a | b c]* $", "('(' [<-[()]> | <~~0>]* ')')"
+    };
+    RxOptions raw = {0};
+    Rx *rx;
+    int i, before, after, unmatched, bad = 0;
+    raw.no_simplify = 1;
+    for (i = 0; i < 4; i++) {
+        rx = rx_new_with(regexes[i], &raw);
+        before = count_states(rx, &unmatched);
+        bad += unmatched;
+        rx_free(rx);
+        rx = rx_new(regexes[i]);
+        after = count_states(rx, &unmatched);
+        bad += unmatched || after >= before;
+        rx_free(rx);
+    }
+    ok(!bad, "simplified graphs are smaller and mirrored");
+    rx = rx_new("'walking' | 'talking'");
+    cmp_ok(count_states(rx, &unmatched), "==", 10,
+           "alternatives share their tails");
+    rx_free(rx);
+}
+
+/* Saves regexes, loads them from a copy of the blob, and checks the
+loaded ones match like the ones they were saved from.  */
+void
+serialize (void) {
+    static const char *regexes[] = {
+        "(\\d+) '-' (\\w+)", "^ <alpha>+ $", "('(' [<-[()]> | <~~0>]* ')')",
+        "ab+c | 'xyz'", "(\\d ** 1..70000) '-'"
+    };
+    static const char *strs[] = {
+        "12-ab", "abc", "x(y(z))", "xabbbc", "xy", "((", "", "1-"
+    };
+    RxOptions options = {0};
+    RxSpan spans[3], expected[3];
+    Rx *rx, *loaded;
+    char *blob;
+    unsigned int *word;
+    Inst *inst;
+    size_t size, at;
+    int i, j, k, bad = 0, refused;
+    for (k = 0; k < 2; k++) {
+        options.full_dfa = k;
+        for (i = 0; i < 5; i++) {
+            rx = rx_new_with(regexes[i], &options);
+            size = rx_serialize(rx, NULL, 0);
+            blob = malloc(size);
+            bad += rx_serialize(rx, blob, size) != size;
+            if (!(loaded = rx_load(blob, size))) {
+                bad++;
+            }
+            else {
+                for (j = 0; j < 8; j++) {
+                    size_t len = strlen(strs[j]);
+                    bad += rx_exec(loaded, strs[j], len, spans, 3) !=
+                           rx_exec(rx, strs[j], len, expected, 3) ||
+                           memcmp(spans, expected, sizeof spans) ||
+                           rx_match_n(loaded, strs[j], len) !=
+                           rx_match_n(rx, strs[j], len);
+                }
+                rx_free(loaded);
+            }
+            free(blob);
+            rx_free(rx);
+        }
+    }
+    ok(!bad, "loaded regexes match like the originals");
+
+    rx = rx_new("'abc'");
+    size = rx_serialize(rx, NULL, 0);
+    blob = malloc(size);
+    rx_serialize(rx, blob, size);
+    ok(!rx_load(blob, size - 1), "rx_load refuses a short blob");
+    blob[4]++;
+    ok(!rx_load(blob, size), "rx_load refuses another version");
+    free(blob);
+    rx_free(rx);
+
+    rx = rx_new("<alpha>+ [x | y]* '-'");
+    size = rx_serialize(rx, NULL, 0);
+    blob = malloc(size);
+    rx_serialize(rx, blob, size);
+    inst = memmem(blob, size, rx->prog->insts,
+                  rx->prog->ninsts * sizeof (Inst));
+    for (i = 0; inst && i < rx->prog->ninsts; i++) {
+        if (inst[i].op == OP_CLASS) {
+            inst[i].arg = rx->prog->nclasses;
+            break;
+        }
+    }
+    ok(inst && !rx_load(blob, size), "rx_load refuses a class out of bounds");
+    rx_serialize(rx, blob, size);
+    inst[rx->prog->ninsts - 1].out = rx->prog->ninsts;
+    ok(!rx_load(blob, size), "rx_load refuses a jump out of bounds");
+    free(blob);
+    rx_free(rx);
+
+    /* Makes each word of a blob in turn point far away, which rx_load()
+    has to either refuse or make a regex of that still runs.  */
+    refused = 0;
+    for (k = 0; k < 2; k++) {
+        options.full_dfa = k;
+        rx = rx_new_with("(<alpha>+) [x | y]* '-'", &options);
+        size = rx_serialize(rx, NULL, 0);
+        blob = malloc(size);
+        for (at = 0; at + sizeof (unsigned int) <= size;
+             at += sizeof (unsigned int)) {
+            rx_serialize(rx, blob, size);
+            word = (unsigned int *) (blob + at);
+            *word = *word ? ~*word : 0x7ffffff0;
+            if (!(loaded = rx_load(blob, size))) {
+                refused++;
+                continue;
+            }
+            for (j = 0; j < 8; j++)
+                rx_exec(loaded, strs[j], strlen(strs[j]), spans, 3);
+            rx_match(loaded, "abcxyxy-");
+            rx_free(loaded);
+        }
+        free(blob);
+        rx_free(rx);
+    }
+    ok(refused, "rx_load refuses corrupt blobs or loads ones that run");
+}
+
+/* Matches quantifiers with bounds too big to unroll, which are counted
+by the backtracker instead.  */
+void
+counted_loops (void) {
+    static const struct {
+        const char *regex;
+        int         length;
+    } slow[] = {
+        {"^ [a?] ** 290 a ** 290 $", 290},
+        {"^ [[a | a] ** 1..65] ** 65..70 $", 66},
+    };
+    char str[5000];
+    RxSpan spans[2];
+    clock_t start;
+    Rx *rx;
+    int i;
+    memset(str, 'f', 4097);
+    str[4097] = 0;
+    rx = rx_new("^ <xdigit> ** 1..4096 $");
+    ok(!prog_backtrack_only(rx->prog), "a loop that fits is unrolled");
+    ok(!rx_match(rx, str), "fail unrolled loop over its bound");
+    str[4096] = 0;
+    ok(rx_match(rx, str), "unrolled loop up to its bound");
+    rx_free(rx);
+    rx = rx_new("[[<xdigit> ** 64] ** 64] ** 64");
+    cmp_ok(rx->prog->ninsts, "<", 20, "loops that don't fit are counted");
+    rx_free(rx);
+    rx = rx_new("^ [<xdigit> ** 2] ** 1..100000 $");
+    ok(prog_backtrack_only(rx->prog), "a loop that doesn't fit is counted");
+    ok(rx_match(rx, str), "counted loop");
+    str[4095] = 0;
+    ok(!rx_match(rx, str), "fail counted loop");
+    rx_free(rx);
+    memset(str, 'a', 250);
+    str[250] = 0;
+    rx = rx_new("a ** 100..200");
+    cmp_ok(rx_exec(rx, str, 250, spans, 2), "==", 1, "exec a counted loop");
+    cmp_ok(spans[0].end - spans[0].beg, "==", 200, "counted loop is greedy");
+    rx_free(rx);
+    rx = rx_new("a ** 100..200?");
+    rx_exec(rx, str, 250, spans, 2);
+    cmp_ok(spans[0].end - spans[0].beg, "==", 100, "frugal counted loop");
+    rx_free(rx);
+    rx = rx_new("(a ** 80) (a ** 1..*)");
+    cmp_ok(rx_exec(rx, str, 250, spans, 2), "==", 1, "exec counted loops");
+    cmp_ok(spans[1].end - spans[1].beg, "==", 80, "counted loop captures");
+    rx_free(rx);
+    rx_unlike (str + 151, "^ a ** 100..* $", "fail open counted loop");
+    rx_like   (str + 150, "^ a ** 100..* $", "open counted loop");
+    rx_like   (str + 50, "^ [a ** 2] ** 100 $", "nested counted loops");
+    rx_unlike (str + 51, "^ [a ** 2] ** 100 $", "fail nested counted loops");
+    rx_like   (str + 90, "^ [a? a?] ** 80 $", "counted loop with empty body");
+    rx_unlike (str + 150, "^ [a?] ** 70 a ** 70 <[bc]>",
+               "pathological counted loop");
+    rx_like   (str + 150, "^ [a?] ** 70 a ** 30 $",
+               "match pathological counted loop");
+    rx_match_is ("aaaaabbb", "a ** 70..100? | a+ b", "aaaaab",
+                 "counted loop in an alternation");
+    for (i = 0; i < sizeof slow / sizeof slow[0]; i++) {
+        memset(str, 'a', slow[i].length);
+        strcpy(str + slow[i].length, "b");
+        start = clock();
+        rx = rx_new(slow[i].regex);
+        ok(!rx_match(rx, str) && !rx_exec(rx, str, strlen(str), spans, 2) &&
+           clock() - start < CLOCKS_PER_SEC,
+           "fail pathological loop '%s' in under a second", slow[i].regex);
+        rx_free(rx);
+    }
+}
+
+/* Matches strings far longer than the C stack could recurse over, and
+checks a match that needs more stack than allowed gives up.  */
+void
+backtrack_stack (void) {
+    RxOptions options = {0};
+    size_t i, n = 1 << 20;
+    char *str = malloc(n + 1);
+    RxSpan spans[2];
+    Rx *rx;
+    rx = rx_new("^ ('(' [<-[()]> | <~~0>]* ')') $");
+    str[0] = '(';
+    memset(str + 1, 'x', n - 2);
+    str[n - 1] = ')';
+    str[n] = 0;
+    ok(rx_match(rx, str) == 1, "call over a megabyte of string");
+    for (i = 0; i < n / 2; i++) {
+        str[i] = '(';
+        str[n - 1 - i] = ')';
+    }
+    ok(rx_match(rx, str) == 1, "calls nested half a million deep");
+    str[n - 1] = 'x';
+    ok(rx_match(rx, str) == 0, "fail calls nested half a million deep");
+    rx_free(rx);
+    memset(str, 'a', n);
+    rx = rx_new("(a ** 1..100000)+ $");
+    ok(rx_exec(rx, str, n, spans, 2) == 1 && spans[0].beg == 0 &&
+       spans[1].beg == n - n % 100000, "counted loops over a megabyte");
+    rx_free(rx);
+    options.backtrack_stack = 4096;
+    rx = rx_new_with("^ ('(' [<-[()]> | <~~0>]* ')') $", &options);
+    ok(rx_match(rx, "(x(x)x)") == 1, "match within the stack limit");
+    str[0] = '(';
+    str[n - 1] = ')';
+    cmp_ok(rx_match_n(rx, str, n), "==", -1, "give up past the stack limit");
+    rx_free(rx);
+    free(str);
+}
+
+/* Matches a grammar that calls the same rule at the same place down
+every path, on a string too long for the bitmap, which only finishes if
+each call is made once per place.  */
+void
+packrat (void) {
+    size_t i, n = 100000;
+    char *str = malloc(2 * n + 1);
+    Rx *rx = rx_new("^ (['a' <~~0>? 'b'] | ['a' <~~0>? 'c']) $");
+    for (i = 0; i < n; i++) {
+        str[i] = 'a';
+        str[n + i] = i % 3 ? 'c' : 'b';
+    }
+    str[2 * n] = 0;
+    ok(rx_match(rx, str) == 1, "rule calls are remembered");
+    str[2 * n - 1] = 'a';
+    ok(rx_match(rx, str) == 0, "failed rule calls are remembered");
+    rx_free(rx);
+    free(str);
+}
+
 int *
 int_new (int x) {
     int *i = malloc(sizeof (int));
@@ -43,7 +899,6 @@ main () {
     rx_like   ("frob", "frob", "multichar match");
     rx_unlike ("frob", "nicate", "fail multichar");
     rx_like   ("abcd", "", "empty regex always matches");
-/*
     rx_like   ("chapter-55, page-44, line-33",
                "([chapter|page|line] - <digit>+) [',' \\s* <~~0>] ** 1..2",
                "synopsis");
@@ -146,7 +1001,66 @@ main () {
     rx_unlike ("abc\ndef\n-==\nghi", "a \\b", "fail \\w\\w word boundary");
     rx_unlike ("abc\ndef\n-==\nghi", "\\= \\b", "fail \\W\\W word boundary");
     rx_like   ("abcdef", "ab\\Bc", "non word boundary");
-*/
+    rx_like   ("abc", "[a|ab]c", "backtrack into group");
+    rx_like   ("xb", "a | ^ x", "assertion only in its own alternative");
+    rx_unlike ("cb", "a | ^ b", "fail assertion only in its own alternative");
+    rx_like   ("aab", "^ [a*]* b", "empty loop body");
+    rx_unlike ("aac", "^ [a*]* b", "fail empty loop body");
+    rx_like   ("sky", "^ <-[aeiou]>+ $", "negated char class");
+    rx_unlike ("ski", "^ <-[aeiou]>+ $", "fail negated char class");
+    rx_like   ("fable", "^ <[a..z] - [m..q]>+ $", "subtracted char class");
+    rx_unlike ("mango", "^ <[a..z] - [m..q]>+ $", "fail subtracted char class");
+    rx_like   ("a-c", "^ <[abc..e]>+ '-' <[a..c]> $", "chars then range in char class");
+    rx_like   ("x\xe9\xff", "^ x <-[a..z]> ** 2 $", "negated char class high bytes");
+    rx_match_is ("abc1", "<alpha>* <alpha>", "abc", "greedy class run backtracks");
+    rx_match_is ("ab12cd", "<alnum>*? \\d", "ab1", "frugal class run");
+    rx_match_is ("x<b><i>", "'<' <-[>]>* '>'", "<b>", "negated char run");
+    rx_match_is ("aaab", "a* ab", "aaab", "char run backtracks");
+    rx_match_is ("a1b2", "[<alpha>* \\d]* b", "a1b", "nested runs");
+    rx_like   ("ab,c!", "^ <[a..z] + punct - [,]>+ ','", "combined char class");
+    rx_unlike ("ab,c!", "^ <[a..z] + punct - [,]>+ $", "fail combined char class");
+    rx_match_is ("xaay", "a+", "aa", "leftmost match");
+    rx_match_is ("xaay", "a*", "", "leftmost empty match");
+    rx_match_is ("<b><i>", "'<' .* '>'", "<b><i>", "greedy");
+    rx_match_is ("<b><i>", "'<' .*? '>'", "<b>", "frugal");
+    rx_match_is ("aaa", "a+?", "a", "frugal +");
+    rx_match_is ("aab", "a?? a b", "aab", "frugal ? backtracks");
+    rx_match_is ("ababab", "[ab] ** 1..2?", "ab", "frugal range");
+    rx_match_is ("ababab", "[ab] ** 1..2", "abab", "greedy range");
+    rx_match_is ("abc", "a | ab", "a", "first alternative wins");
+    rx_match_is ("abc", "[a | ab] c", "abc", "later alternative when first fails");
+    rx_match_is ("abcd", "[a | ab] [c | bcd]", "abcd", "alternatives backtrack");
+    rx_match_is ("aa", "[a*?]*", "aa", "empty time round a loop fails");
+    rx_match_is ("aab", "[a *? b*]*", "aab", "empty time round a loop backtracks");
+    rx_match_is ("aaN", "[a *? <-[a]> *]*", "aaN",
+                 "empty time round a loop backtracks into a run");
+    rx_match_is ("foofoofoo x", "foo<~~>*", "foofoofoo", "calls use the backtracker");
+    rx_like   ("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+               "[a?] ** 30 a ** 30", "pathological nested quantifiers");
+    rx_match_is ("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                 "[a?] ** 30 a ** 30", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+                 "pathological nested quantifiers backtracking");
+    rx_match_is ("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+                 "([a?] ** 15 a ** 15) <~~0> b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+                 "pathological nested quantifiers in calls");
+    rx_match_is ("xx", "<~~>? x", "xx", "recursion at the same offset fails");
+    dfa_cache_thrash();
+    full_dfa();
+    literal_prefix();
+    required_factors();
+    byte_sets();
+    long_runs();
+    rx_set();
+    binary_strings();
+    streams();
+    captures();
+    scratch();
+    cache();
+    serialize();
+    simplify();
+    counted_loops();
+    backtrack_stack();
+    packrat();
     return exit_status();
 }
 
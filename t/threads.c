@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "tap.h"
+#include "../rx.h"
+
+/*
+Matches regexes and a set compiled once from many threads at the same
+time, some with their own scratch and some with the regex's, and gets
+and releases the same regexes from a cache too small to hold them all.
+Every answer is checked against the one worked out before the threads
+started.
+Run it under -fsanitize=thread to have races reported.
+*/
+
+#define NTHREADS 8
+#define NROUNDS  200
+
+static const char *regexes[] = {
+    "'GET ' \\S+", "(\\w+) '=' (\\w+)", "<alpha>+ \\d", "(a+) <~~0>",
+    "[a?] ** 12 a ** 12", "^^ 'x' .* $$", "<-[,]>+ ','"
+};
+
+#define NREGEXES (sizeof regexes / sizeof regexes[0])
+
+static const char *strs[] = {
+    "GET /index.html", "key=value", "abc1", "aaaaaaaaaaaaaa",
+    "aaaaaaaaaaaa", "a\nxyz\nb", "one,two", "", "nothing to see",
+    "k=v GET /x aaa,"
+};
+
+#define NSTRS (sizeof strs / sizeof strs[0])
+
+static Rx *rxs[NREGEXES];
+static RxSet *set;
+static RxCache *cache;
+static RxSpan expected[NREGEXES][NSTRS][3];
+static int expected_match[NREGEXES][NSTRS];
+static int expected_set[NSTRS];
+
+static void *
+worker (void *arg) {
+    long id = (long) arg, bad = 0;
+    RxScratch *scratch = rx_scratch_new(rxs[0]);
+    RxScratch *setscratch = rx_set_scratch_new(set);
+    RxSpan spans[3];
+    int ids[NREGEXES];
+    int round, i, j, got;
+    size_t len;
+    Rx *rx;
+    for (i = 1; i < NREGEXES; i++)
+        rx_scratch_fit(scratch, rxs[i]);
+    for (round = 0; round < NROUNDS; round++) {
+        for (j = 0; j < NSTRS; j++) {
+            len = strlen(strs[j]);
+            for (i = 0; i < NREGEXES; i++) {
+                if ((round + id) % 2)
+                    got = rx_match_with(rxs[i], scratch, strs[j], len,
+                                        spans, 3);
+                else
+                    got = rx_exec(rxs[i], strs[j], len, spans, 3);
+                bad += got != expected_match[i][j] ||
+                       memcmp(spans, expected[i][j], sizeof spans) ||
+                       rx_match(rxs[i], strs[j]) != expected_match[i][j];
+                rx = rx_cache_get(cache, regexes[i]);
+                bad += rx_match(rx, strs[j]) != expected_match[i][j];
+                rx_cache_release(cache, rx);
+            }
+            if ((round + id) % 2)
+                got = rx_set_match_with(set, setscratch, strs[j], len, ids,
+                                        NREGEXES);
+            else
+                got = rx_set_match_n(set, strs[j], len, ids, NREGEXES);
+            bad += got != expected_set[j];
+        }
+    }
+    rx_scratch_free(scratch);
+    rx_scratch_free(setscratch);
+    return (void *) bad;
+}
+
+int
+main () {
+    pthread_t threads[NTHREADS];
+    void *bad;
+    long total = 0;
+    int ids[NREGEXES];
+    size_t i, j;
+    for (i = 0; i < NREGEXES; i++)
+        rxs[i] = rx_new(regexes[i]);
+    set = rx_set_new(NULL);
+    for (i = 0; i < NREGEXES; i++)
+        rx_set_add(set, regexes[i]);
+    rx_set_compile(set);
+    cache = rx_cache_new(16384);
+    for (i = 0; i < NREGEXES; i++) {
+        for (j = 0; j < NSTRS; j++) {
+            expected_match[i][j] = rx_exec(rxs[i], strs[j], strlen(strs[j]),
+                                           expected[i][j], 3);
+        }
+    }
+    for (j = 0; j < NSTRS; j++)
+        expected_set[j] = rx_set_match(set, strs[j], ids, NREGEXES);
+    for (i = 0; i < NTHREADS; i++)
+        pthread_create(&threads[i], NULL, worker, (void *) i);
+    for (i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], &bad);
+        total += (long) bad;
+    }
+    cmp_ok(total, "==", 0, "threads agree with a single thread");
+    for (i = 0; i < NREGEXES; i++)
+        rx_free(rxs[i]);
+    rx_set_free(set);
+    rx_cache_free(cache);
+    return exit_status();
+}
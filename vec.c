@@ -0,0 +1,24 @@
+#include <string.h>
+#include "rxpriv.h"
+
+/*
+The parser's growable arrays: the transitions of each state, the groups
+of a regex and the actions of a char class. They live in the regex's
+arena like everything else the parser makes. When one fills up it moves
+to a new array twice the size and leaves the old one for the arena to
+free, so appending takes constant time on average and an array never
+wastes more room than it uses.
+*/
+
+void
+vec_push (Arena *arena, Vec *vec, void *item) {
+    void **items;
+    if (vec->n == vec->size) {
+        vec->size = vec->size ? 2 * vec->size : 4;
+        items = arena_alloc(arena, vec->size * sizeof (void *));
+        if (vec->n)
+            memcpy(items, vec->items, vec->n * sizeof (void *));
+        vec->items = items;
+    }
+    vec->items[vec->n++] = item;
+}